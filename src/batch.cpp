@@ -0,0 +1,341 @@
+// chip8_batch: run many independent ROM instances headless, across all cores.
+//
+// Every instance runs for a cycle budget with the timers ticking on virtual
+// time (every --ipf instructions), then its final state hash and framebuffer
+// are written out, one line per instance in input order:
+//
+//   <rom path> <cycles> <state hash> <framebuffer>
+//
+// where the framebuffer is the rows of the display in hex: 32 rows of 16
+// digits each in the 64x32 mode, 64 rows of 32 digits in the 128x64 one. If
+// anything is drawn on XO-CHIP's second plane, a '/' and that plane's rows
+// follow. An instance that traps (see Chip8Trap) stops there, and its line
+// ends with the trap's name, e.g. "stack-overflow".
+//
+// Instances share nothing mutable, so throughput scales with the number of
+// worker threads. Every instance seeds its random number generator from
+// --seed or its manifest line, so the output is the same from run to run, and
+// takes its quirk profile from --quirks or its manifest line.
+//
+// Jobs are handed to the workers in groups, and each group's machines are
+// allocated together from one Chip8Pool arena.
+//
+// Two shortcuts, both keyed on Chip8::stateHash(), skip work whose result is
+// already known; --no-shortcuts turns them off to check they change nothing.
+// Jobs that start in the same state, e.g. the same ROM under two names, and
+// run for as long are only run once. And a run that comes back to a state it
+// was in at an earlier frame will only keep repeating the frames in between,
+// so it skips ahead by whole repeats. Repeats are found with Brent's
+// algorithm, which compares each frame's hash with one saved hash and finds
+// a loop within a few times its length.
+
+#include "chip8.h"
+#include "chip8_pool.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// How many jobs a worker takes at a time.
+constexpr size_t JOBS_PER_TASK = 64;
+
+struct BatchJob
+{
+    std::string romFilepath;
+    uint64_t cycles;
+    uint64_t seed;
+    Chip8Profile profile;
+};
+
+struct BatchResult
+{
+    uint64_t stateHash;
+    std::string framebuffer;
+    Chip8Trap trap;
+};
+
+struct BatchOptions
+{
+    uint64_t cycles = 10000000;
+    uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    unsigned threads = std::thread::hardware_concurrency();
+    Chip8Engine engine = DEFAULT_ENGINE;
+    Chip8Profile profile = DEFAULT_PROFILE;
+    uint64_t seed = DEFAULT_RANDOM_SEED;
+    const char* outFilepath = nullptr;
+    bool shortcuts = true;
+};
+
+static void printUsage()
+{
+    printf("Usage: chip8_batch [--cycles N] [--ipf N] [--threads N] "
+           "[--engine NAME] [--quirks PROFILE] [--seed N] [--manifest FILE] "
+           "[--out FILE] [--no-shortcuts] [ROM filepath...]\n"
+           "\n"
+           "Manifest files list one job per line as \"<ROM filepath> "
+           "[cycles [seed [profile]]]\";\nblank lines and lines starting "
+           "with # are ignored. Profiles are vip, chip48, schip and "
+           "xochip.\n");
+}
+
+static bool readManifest(const char* manifestFilepath,
+    const BatchOptions& options, std::vector<BatchJob>& jobs)
+{
+    std::ifstream manifest(manifestFilepath);
+    if (!manifest.is_open()) {
+        fprintf(stderr, "Failed to read manifest: %s\n", manifestFilepath);
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.romFilepath) || job.romFilepath[0] == '#')
+            continue;
+        if (!(fields >> job.cycles))
+            job.cycles = options.cycles;
+        if (!(fields >> job.seed))
+            job.seed = options.seed;
+        std::string profile;
+        job.profile = options.profile;
+        if (fields >> profile && !parseProfileName(profile, job.profile)) {
+            fprintf(stderr, "Unknown quirk profile in %s: %s\n",
+                manifestFilepath, profile.c_str());
+            return false;
+        }
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+static std::string formatFramebuffer(const Chip8& emulator)
+{
+    const int rows = emulator.hires ? 64 : 32;
+    const int words = emulator.hires ? 2 : 1;
+
+    std::string text;
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        std::string planeText;
+        bool lit = false;
+        for (int row = 0; row < rows; ++row) {
+            for (int word = 0; word < words; ++word) {
+                const uint64_t bits
+                    = emulator.display[1].bits[plane][row][word];
+                char digits[17];
+                snprintf(digits, sizeof(digits), "%016llx",
+                    (unsigned long long)bits);
+                planeText += digits;
+                lit |= bits != 0;
+            }
+        }
+
+        if (plane == 0)
+            text = planeText;
+        else if (lit)
+            text += "/" + planeText;
+    }
+    return text;
+}
+
+static BatchResult runJob(
+    Chip8& emulator, const BatchJob& job, const BatchOptions& options)
+{
+    emulator.setEngine(options.engine);
+
+    const uint64_t frames = job.cycles / options.instructionsPerFrame;
+    bool findLoop = options.shortcuts;
+    // Brent's algorithm: the hash of the state power frames ago, at most.
+    uint64_t savedHash = emulator.stateHash();
+    uint64_t sinceSaved = 0;
+    uint64_t power = 1;
+
+    for (uint64_t frame = 0; frame < frames; ++frame) {
+        if (emulator.runFrame(options.instructionsPerFrame)
+            != Chip8Trap::None)
+            break;
+        if (!findLoop)
+            continue;
+
+        const uint64_t hash = emulator.stateHash();
+        ++sinceSaved;
+        if (hash == savedHash) {
+            // Back where it was sinceSaved frames ago, so the same frames
+            // follow again and again.
+            const uint64_t remaining = frames - frame - 1;
+            frame += remaining / sinceSaved * sinceSaved;
+            findLoop = false;
+        } else if (sinceSaved == power) {
+            savedHash = hash;
+            sinceSaved = 0;
+            power *= 2;
+        }
+    }
+
+    const uint64_t rest = job.cycles % options.instructionsPerFrame;
+    if (rest != 0 && emulator.trap == Chip8Trap::None)
+        emulator.runFrame(rest);
+
+    BatchResult result;
+    result.stateHash = emulator.stateHash();
+    result.framebuffer = formatFramebuffer(emulator);
+    result.trap = emulator.trap;
+    return result;
+}
+
+static void runJobs(const std::vector<BatchJob>& jobs,
+    const std::vector<size_t>& indices, size_t first, size_t last,
+    const BatchOptions& options, std::vector<BatchResult>& results)
+{
+    Chip8Pool machines(last - first);
+    for (size_t i = first; i < last; ++i) {
+        const BatchJob& job = jobs[indices[i]];
+        machines.create(job.romFilepath, job.seed, job.profile);
+    }
+    for (size_t i = first; i < last; ++i) {
+        results[indices[i]]
+            = runJob(machines[i - first], jobs[indices[i]], options);
+    }
+}
+
+// Split jobs into those to run, returned, and those that will end exactly
+// like an earlier one, which sameAs maps to it.
+static std::vector<size_t> findDuplicates(const std::vector<BatchJob>& jobs,
+    const BatchOptions& options, std::vector<size_t>& sameAs)
+{
+    std::vector<size_t> unique;
+    sameAs.assign(jobs.size(), SIZE_MAX);
+    std::map<std::tuple<uint64_t, Chip8Profile, uint64_t>, size_t> seen;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (!options.shortcuts) {
+            unique.push_back(i);
+            continue;
+        }
+
+        // The profile isn't part of the state, but decides what it becomes.
+        const Chip8 start(jobs[i].romFilepath, jobs[i].seed, jobs[i].profile);
+        const auto [earlier, isNew] = seen.try_emplace(
+            { start.stateHash(), jobs[i].profile, jobs[i].cycles }, i);
+        if (isNew)
+            unique.push_back(i);
+        else
+            sameAs[i] = earlier->second;
+    }
+    return unique;
+}
+
+static void writeResult(
+    FILE* out, const BatchJob& job, const BatchResult& result)
+{
+    fprintf(out, "%s %llu %016llx %s", job.romFilepath.c_str(),
+        (unsigned long long)job.cycles, (unsigned long long)result.stateHash,
+        result.framebuffer.c_str());
+    if (result.trap != Chip8Trap::None)
+        fprintf(out, " %s", trapName(result.trap));
+    fputc('\n', out);
+}
+
+int main(const int argc, char* argv[])
+{
+    BatchOptions options;
+    std::vector<const char*> manifests;
+    std::vector<std::string> romFilepaths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            options.cycles = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+            options.instructionsPerFrame = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            options.threads = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!parseEngineName(argv[++i], options.engine)) {
+                printUsage();
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            if (!parseProfileName(argv[++i], options.profile)) {
+                printUsage();
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            options.seed = std::stoull(argv[++i], nullptr, 0);
+        else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc)
+            manifests.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            options.outFilepath = argv[++i];
+        else if (strcmp(argv[i], "--no-shortcuts") == 0)
+            options.shortcuts = false;
+        else if (argv[i][0] != '-')
+            romFilepaths.push_back(argv[i]);
+        else {
+            printUsage();
+            exit(1);
+        }
+    }
+
+    if (options.instructionsPerFrame == 0) {
+        printUsage();
+        exit(1);
+    }
+
+    std::vector<BatchJob> jobs;
+    for (const char* manifest : manifests) {
+        if (!readManifest(manifest, options, jobs))
+            exit(1);
+    }
+    for (const std::string& romFilepath : romFilepaths)
+        jobs.push_back(
+            { romFilepath, options.cycles, options.seed, options.profile });
+
+    if (jobs.empty()) {
+        printUsage();
+        exit(1);
+    }
+
+    std::vector<size_t> sameAs;
+    const std::vector<size_t> unique = findDuplicates(jobs, options, sameAs);
+
+    std::vector<BatchResult> results(jobs.size());
+    {
+        WorkStealingPool pool(options.threads);
+        for (size_t first = 0; first < unique.size();
+             first += JOBS_PER_TASK) {
+            const size_t last = std::min(first + JOBS_PER_TASK, unique.size());
+            pool.submit([&jobs, &unique, &results, &options, first, last] {
+                runJobs(jobs, unique, first, last, options, results);
+            });
+        }
+        pool.wait();
+    }
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (sameAs[i] != SIZE_MAX)
+            results[i] = results[sameAs[i]];
+    }
+
+    FILE* out = stdout;
+    if (options.outFilepath != nullptr) {
+        out = fopen(options.outFilepath, "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Failed to open output: %s\n", options.outFilepath);
+            exit(1);
+        }
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+        writeResult(out, jobs[i], results[i]);
+
+    if (out != stdout)
+        fclose(out);
+}
@@ -0,0 +1,296 @@
+// chip8_bench: measure raw interpreter throughput on a ROM.
+//
+// The ROM is run headless for a fixed number of instructions, several times
+// over, with the timers ticking on virtual time (every --ipf instructions) so
+// the result doesn't depend on the host scheduler. Every engine is measured
+// unless one is picked with --engine. Afterwards a separate, untimed pass
+// records the opcode mix of the same run.
+//
+// The lockstep engine is measured at every lane count unless one is picked
+// with --lanes. It splits the same total instruction count across its lanes,
+// so its MIPS are directly comparable with the scalar engines'.
+//
+// The sprite draw kernel is also timed on its own, since draw-heavy ROMs spend
+// most of their time in it: 15-row sprites at pseudo-random positions, most of
+// which cross an edge, in both resolutions and with clipping and wrapping.
+
+#include "chip8.h"
+#include "chip8_lockstep.h"
+#include "chip8_ops.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct BenchOptions
+{
+    const char* romFilepath = nullptr;
+    uint64_t cycles = 100000000;
+    uint64_t instructionsPerFrame = 1000;
+    int runs = 5;
+    Chip8Profile profile = DEFAULT_PROFILE;
+    bool opcodeMix = true;
+    bool drawKernel = true;
+    std::vector<Chip8Engine> engines = availableEngines();
+    std::vector<int> laneCounts = { 8, 16, 32 };
+};
+
+static void printUsage()
+{
+    printf("Usage: chip8_bench [--cycles MILLIONS] [--ipf N] [--runs N] "
+           "[--engine NAME] [--lanes 8|16|32] [--quirks PROFILE] [--no-mix] "
+           "[--no-draw] <ROM filepath>\n");
+    printf("Engines:");
+    for (Chip8Engine engine : availableEngines())
+        printf(" %s", engineName(engine));
+    printf("\nProfiles:");
+    for (Chip8Profile profile : availableProfiles())
+        printf(" %s", profileName(profile));
+    printf("\n");
+}
+
+static double timeRun(const BenchOptions& options, Chip8Engine engine)
+{
+    Chip8 emulator(options.romFilepath, DEFAULT_RANDOM_SEED, options.profile);
+    emulator.setEngine(engine);
+    // Every instruction is executed, so that waiting ROMs measure the engine
+    // rather than how much of their time is skipped.
+    emulator.setIdleSkipping(false);
+
+    auto start = std::chrono::steady_clock::now();
+
+    const uint64_t startCycle = emulator.cycleCount;
+    uint64_t executed = 0;
+    while (executed < options.cycles && emulator.trap == Chip8Trap::None) {
+        uint64_t n = std::min(
+            options.cycles - executed, options.instructionsPerFrame);
+        emulator.runFrame(n);
+        executed += n;
+    }
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+
+    // A trapped machine executes nothing, which would time as very fast. A
+    // frame that traps executes only part of n, so the count comes from the
+    // machine.
+    if (emulator.trap != Chip8Trap::None) {
+        printf("ROM stopped at 0x%03X after %llu instructions: %s\n",
+            emulator.PC,
+            (unsigned long long)(emulator.cycleCount - startCycle),
+            trapName(emulator.trap));
+        exit(1);
+    }
+    return elapsed.count();
+}
+
+template <int Lanes>
+static double timeLockstepRun(const BenchOptions& options)
+{
+    Chip8 prototype(options.romFilepath, DEFAULT_RANDOM_SEED, options.profile);
+    auto lanes = std::make_unique<Chip8Lockstep<Lanes>>(prototype);
+
+    const uint64_t cycles = options.cycles / Lanes;
+    auto start = std::chrono::steady_clock::now();
+
+    uint64_t executed = 0;
+    while (executed < cycles) {
+        uint64_t n = std::min(cycles - executed, options.instructionsPerFrame);
+        lanes->runFrame(n);
+        executed += n;
+    }
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static void printTimes(const char* name, std::vector<double> seconds,
+    const BenchOptions& options)
+{
+    std::sort(seconds.begin(), seconds.end());
+
+    const double best = seconds.front();
+    const double median = seconds[seconds.size() / 2];
+
+    printf("  %-10s best   %8.3fs  %9.2f MIPS  %7.3f ns/instruction\n", name,
+        best, options.cycles / best / 1e6, best * 1e9 / options.cycles);
+    printf("  %-10s median %8.3fs  %9.2f MIPS  %7.3f ns/instruction\n", "",
+        median, options.cycles / median / 1e6, median * 1e9 / options.cycles);
+}
+
+// Sprites drawn per run of the draw kernel benchmark.
+static constexpr uint64_t DRAW_CALLS = 2000000;
+
+template <Chip8Quirks Quirks>
+static double timeDraws(const BenchOptions& options, bool hires)
+{
+    Chip8 emulator(options.romFilepath);
+    emulator.hires = hires;
+    // The sprite is 15 bytes of the font.
+    emulator.I = 0;
+    const Chip8Instruction in = decodeOperands(0xD01F);
+
+    // Positions are drawn ahead of time so only the kernel is timed.
+    Chip8Random random;
+    std::vector<uint8_t> positions(2 * DRAW_CALLS);
+    for (uint8_t& position : positions)
+        position = random.nextByte();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < DRAW_CALLS; ++i) {
+        emulator.V[0] = positions[2 * i];
+        emulator.V[1] = positions[2 * i + 1];
+        opDRW<Quirks>(emulator, in);
+    }
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+template <Chip8Quirks Quirks>
+static void printDrawTimes(
+    const BenchOptions& options, const char* name, bool hires)
+{
+    std::vector<double> seconds;
+    for (int run = 0; run < options.runs; ++run)
+        seconds.push_back(timeDraws<Quirks>(options, hires));
+    std::sort(seconds.begin(), seconds.end());
+
+    printf("  %-12s best %7.3f ns/draw  median %7.3f ns/draw\n", name,
+        seconds.front() * 1e9 / DRAW_CALLS,
+        seconds[seconds.size() / 2] * 1e9 / DRAW_CALLS);
+}
+
+static void printOpcodeMix(const BenchOptions& options)
+{
+    Chip8 emulator(options.romFilepath, DEFAULT_RANDOM_SEED, options.profile);
+    std::map<std::string, uint64_t> counts;
+
+    uint64_t executed = 0;
+    while (executed < options.cycles) {
+        for (uint64_t i = 0; i < options.instructionsPerFrame
+             && executed < options.cycles;
+             ++i, ++executed) {
+            uint16_t opcode = (emulator.memory[emulator.PC] << 8)
+                | emulator.memory[emulator.PC + 1];
+            ++counts[opcodeClassName(opcode)];
+            emulator.step();
+        }
+        emulator.tickTimers();
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> sorted(
+        counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    printf("\nopcode mix:\n");
+    for (const auto& [name, count] : sorted) {
+        printf("  %s %12llu  %6.2f%%\n", name.c_str(),
+            (unsigned long long)count, 100.0 * count / executed);
+    }
+}
+
+int main(const int argc, char* argv[])
+{
+    BenchOptions options;
+    bool pickedEngine = false;
+    bool pickedLanes = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            options.cycles = std::stoull(argv[++i]) * 1000000;
+        else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+            options.instructionsPerFrame = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            options.runs = std::stoi(argv[++i]);
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            Chip8Engine engine;
+            if (!parseEngineName(argv[++i], engine)) {
+                printUsage();
+                exit(1);
+            }
+            options.engines = { engine };
+            pickedEngine = true;
+        } else if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc) {
+            int laneCount = std::stoi(argv[++i]);
+            if (laneCount != 8 && laneCount != 16 && laneCount != 32) {
+                printUsage();
+                exit(1);
+            }
+            options.laneCounts = { laneCount };
+            pickedLanes = true;
+        } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            if (!parseProfileName(argv[++i], options.profile)) {
+                printUsage();
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--no-mix") == 0)
+            options.opcodeMix = false;
+        else if (strcmp(argv[i], "--no-draw") == 0)
+            options.drawKernel = false;
+        else if (options.romFilepath == nullptr && argv[i][0] != '-')
+            options.romFilepath = argv[i];
+        else {
+            printUsage();
+            exit(1);
+        }
+    }
+
+    if (options.romFilepath == nullptr || options.cycles == 0
+        || options.instructionsPerFrame == 0 || options.runs <= 0) {
+        printUsage();
+        exit(1);
+    }
+
+    // Picking only one kind of engine leaves out the other kind.
+    if (pickedEngine && !pickedLanes)
+        options.laneCounts.clear();
+    if (pickedLanes && !pickedEngine)
+        options.engines.clear();
+
+    printf("%s: %llu instructions x %d runs, %s quirks\n",
+        options.romFilepath, (unsigned long long)options.cycles, options.runs,
+        profileName(options.profile));
+
+    for (Chip8Engine engine : options.engines) {
+        std::vector<double> seconds;
+        for (int run = 0; run < options.runs; ++run)
+            seconds.push_back(timeRun(options, engine));
+        printTimes(engineName(engine), seconds, options);
+    }
+
+    for (int laneCount : options.laneCounts) {
+        std::vector<double> seconds;
+        for (int run = 0; run < options.runs; ++run) {
+            if (laneCount == 8)
+                seconds.push_back(timeLockstepRun<8>(options));
+            else if (laneCount == 16)
+                seconds.push_back(timeLockstepRun<16>(options));
+            else
+                seconds.push_back(timeLockstepRun<32>(options));
+        }
+        const std::string name = "lockstep" + std::to_string(laneCount);
+        printTimes(name.c_str(), seconds, options);
+    }
+
+    if (options.drawKernel) {
+        printf("\ndraw kernel:\n");
+        printDrawTimes<VIP_QUIRKS>(options, "64x32 clip", false);
+        printDrawTimes<XOCHIP_QUIRKS>(options, "64x32 wrap", false);
+        printDrawTimes<VIP_QUIRKS>(options, "128x64 clip", true);
+        printDrawTimes<XOCHIP_QUIRKS>(options, "128x64 wrap", true);
+    }
+
+    if (options.opcodeMix)
+        printOpcodeMix(options);
+}
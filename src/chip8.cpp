@@ -1,640 +1,545 @@
 #include "chip8.h"
+#include "chip8_hash.h"
+#include "chip8_ops.h"
+
+#ifdef CHIP8_JIT
+#include "chip8_jit.h"
+#endif
+
+#ifdef CHIP8_INSTRUMENT
+#include "chip8_stats.h"
+#endif
 
-#include <SDL.h>
-#include <chrono>
 #include <cstdio>
-#include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <iostream>
-#include <vector>
-
-void THROW_UNRECOGNISED_OPCODE(uint32_t opcode)
-{
-    printf("Invalid instruction! opcode: 0x%04X\n", opcode);
-    exit(1);
-}
 
-Chip8::Chip8(const std::string& romFilepath)
+Chip8::Chip8(
+    const std::string& romFilepath, uint64_t seed, Chip8Profile profile)
+    : cycleCount(0)
+    , random(seed)
+    , quirksProfile(profile)
 {
-    clearMemory();
-    loadROMFileFromPath(romFilepath);
+    // A ROM that fails to load leaves a machine with empty program memory,
+    // which is reported but not fatal. An empty path asks for that quietly.
+    if (!romFilepath.empty())
+        romImage = Chip8RomCache::shared().load(romFilepath, profile);
+    if (!romImage)
+        romImage = Chip8RomCache::blankImage();
+    memory = romImage->memory;
+    PC = Chip8RomCache::ROM_START;
+    for (uint8_t& i : V)
+        i = 0;
+    I = 0;
     SP = 0;
+    for (uint16_t& i : stack)
+        i = 0;
     delayTimer = 0;
+    soundTimer = 0;
+    trap = Chip8Trap::None;
     for (bool& i : keyboard)
         i = false;
-    for (int i = 0; i < 32; ++i) {
-        this->display[0].bits[i] = 0ull;
-        this->display[1].bits[i] = 0ull;
-    }
+    memset(display, 0, sizeof(display));
+    dirtyRows = ~0ull;
+    hires = false;
+    planeMask = 1;
+    for (uint8_t& i : flags)
+        i = 0;
+    for (uint8_t& i : audioPattern)
+        i = 0;
+    pitch = 64;
 }
 
-void Chip8::clearMemory()
+Chip8::~Chip8() = default;
+
+Chip8::Chip8(const Chip8& parent)
+    : I(parent.I)
+    , PC(parent.PC)
+    , SP(parent.SP)
+    , delayTimer(parent.delayTimer)
+    , soundTimer(parent.soundTimer)
+    , trap(parent.trap)
+    , cycleCount(parent.cycleCount)
+    , memory(parent.memory)
+    , dirtyRows(parent.dirtyRows)
+    , hires(parent.hires)
+    , planeMask(parent.planeMask)
+    , pitch(parent.pitch)
+    , random(parent.random)
+    , romImage(parent.romImage)
+    , quirksProfile(parent.quirksProfile)
+    , engine(parent.engine)
 {
-    for (unsigned char& i : memory)
-        i = 0;
+    memcpy(V, parent.V, sizeof(V));
+    memcpy(stack, parent.stack, sizeof(stack));
+    memcpy(keyboard, parent.keyboard, sizeof(keyboard));
+    memcpy(display, parent.display, sizeof(display));
+    memcpy(rowHashes, parent.rowHashes, sizeof(rowHashes));
+    staleRowHashes = parent.staleRowHashes;
+    memcpy(flags, parent.flags, sizeof(flags));
+    memcpy(audioPattern, parent.audioPattern, sizeof(audioPattern));
+}
 
-    for (int spriteIdx = 0; spriteIdx < 16; ++spriteIdx) {
-        for (int spriteLineIdx = 0; spriteLineIdx < 5; ++spriteLineIdx) {
-            memory[spriteIdx * 5 + spriteLineIdx]
-                = NUMBER_SPRITES[spriteIdx][spriteLineIdx];
+std::unique_ptr<Chip8> Chip8::fork() const
+{
+    return std::unique_ptr<Chip8>(new Chip8(*this));
+}
+
+void print_opcode(uint16_t opcode) { printf("0x%04X\n", opcode); }
+
+void Chip8::step()
+{
+    visitQuirks(quirksProfile,
+        [&]<Chip8Quirks Quirks>() { stepInstruction<Quirks>(*this); });
+}
+
+Chip8Trap Chip8::runCycles(uint64_t n)
+{
+    if (trap != Chip8Trap::None)
+        return trap;
+
+#ifdef CHIP8_INSTRUMENT
+    if (stats != nullptr) {
+        visitQuirks(quirksProfile, [&]<Chip8Quirks Quirks>() {
+            for (uint64_t i = 0; i < n && trap == Chip8Trap::None; ++i) {
+                stats->countInstruction(
+                    PC, (memory[PC] << 8) | memory[PC + 1]);
+                stepInstruction<Quirks>(*this);
+                ++cycleCount;
+            }
+        });
+        return trap;
+    }
+#endif
+
+    if (!idleSkipping) {
+        cycleCount += runEngine(n);
+        return trap;
+    }
+
+    while (n > 0 && trap == Chip8Trap::None) {
+        if (skipIdleLoop(n)) {
+            cycleCount += n;
+            break;
         }
+        const uint64_t chunk
+            = n < IDLE_CHECK_INTERVAL ? n : IDLE_CHECK_INTERVAL;
+        cycleCount += runEngine(chunk);
+        n -= chunk;
     }
+    return trap;
 }
 
-void Chip8::loadROMFileFromPath(const std::string& romFilepath)
+uint64_t Chip8::runEngine(uint64_t n)
 {
-    std::fstream romFile(romFilepath);
-    if (!romFile.is_open()) {
-        std::cerr << "Failed to read file: " << romFilepath << std::endl;
-        return;
+    switch (engine) {
+    case Chip8Engine::Switch: {
+        uint64_t executed = 0;
+        visitQuirks(quirksProfile, [&]<Chip8Quirks Quirks>() {
+            while (executed < n) {
+                stepInstruction<Quirks>(*this);
+                ++executed;
+                if (trap != Chip8Trap::None)
+                    break;
+            }
+        });
+        return executed;
+    }
+    case Chip8Engine::Predecoded:
+        return runPredecoded(n);
+#ifdef CHIP8_THREADED_DISPATCH
+    case Chip8Engine::Threaded:
+        return runThreaded(n);
+#endif
+#ifdef CHIP8_JIT
+    case Chip8Engine::Jit: {
+        if (!jit)
+            jit = std::make_unique<Chip8Jit>(*this);
+        // Whatever the JIT can't run for want of executable memory runs on
+        // the predecoded engine instead.
+        uint64_t executed = jit->run(n);
+        if (executed < n && trap == Chip8Trap::None)
+            executed += runPredecoded(n - executed);
+        return executed;
     }
-    int i = 0;
-    while (romFile)
-        memory[0x200 + (i++)] = romFile.get();
-    PC = 0x200;
-    romFile.close();
+#endif
+    }
+    return 0;
 }
 
-void print_opcode(uint16_t opcode) { printf("0x%04X\n", opcode); }
+uint16_t Chip8::opcodeAt(uint16_t address) const
+{
+    return (memory[address] << 8) | memory[(uint16_t)(address + 1)];
+}
+
+// Whether opcode is 1nnn jumping to target. Jumps only reach the first 4 KiB,
+// so nothing past that is ever a target.
+static bool isJumpTo(uint16_t opcode, uint16_t target)
+{
+    return (opcode & 0xF000) == 0x1000 && (opcode & 0x0FFF) == target
+        && target < 0x1000;
+}
 
-void Chip8::drawDisplayToTerminal()
+// Keys and timers only change between calls to runCycles(), so a loop that
+// waits on either can't end within one: executing the rest of the call is the
+// same as working out where in the loop it leaves PC.
+bool Chip8::skipIdleLoop(uint64_t n)
 {
-    for (const auto bit : display[1].bits) {
-        std::bitset<64> row(bit);
-        std::cout << row << '\n';
+    const uint16_t opcode = opcodeAt(PC);
+
+    // Fx0A with no key held stays put.
+    if ((opcode & 0xF0FF) == 0xF00A) {
+        for (int i = 0; i < 16; ++i) {
+            if (keyboard[i])
+                return false;
+        }
+        return true;
+    }
+
+    // A jump to itself, which ROMs often end on.
+    if (isJumpTo(opcode, PC))
+        return true;
+
+    // Polling the delay timer: Fx07, then 3xkk or 4xkk skipping past the
+    // jump back to the Fx07 once Vx is done, e.g. once it reaches zero. PC
+    // can be at any of the three.
+    for (int position = 0; position < 3; ++position) {
+        const uint16_t start = PC - 2 * position;
+        const uint16_t load = opcodeAt(start);
+        const uint16_t test = opcodeAt(start + 2);
+        if ((load & 0xF0FF) != 0xF007 || !isJumpTo(opcodeAt(start + 4), start)
+            || ((test & 0xF000) != 0x3000 && (test & 0xF000) != 0x4000)
+            || (test & 0x0F00) != (load & 0x0F00))
+            continue;
+
+        // Past the Fx07, Vx holds what the timer was when it ran, which may
+        // be before the last tick.
+        const int x = (load & 0x0F00) >> 8;
+        if (position != 0 && V[x] != delayTimer)
+            return false;
+        // Whether the test skips the jump, leaving the loop.
+        const bool equal = delayTimer == (test & 0x00FF);
+        if (equal == ((test & 0xF000) == 0x3000))
+            return false;
+
+        V[x] = delayTimer;
+        PC = start + 2 * ((position + n) % 3);
+        return true;
     }
+
+    return false;
 }
 
-void Chip8::run()
+void Chip8::setEngine(Chip8Engine engine) { this->engine = engine; }
+
+void Chip8::storeMemory(uint16_t address, uint8_t value)
 {
+    memory.store(address, value);
+    invalidateCode(address);
+}
 
-    std::vector<SDL_Rect> rectangles;
-    rectangles.reserve(2048);
-
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
-        printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
-    else {
-        SDL_Window* window = NULL;
-        constexpr int SCREEN_HEIGHT = 320;
-        constexpr int SCREEN_WIDTH = 640;
-
-        window = SDL_CreateWindow("chip8", SDL_WINDOWPOS_UNDEFINED,
-            SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT,
-            SDL_WINDOW_SHOWN);
-
-        if (window == nullptr)
-            printf(
-                "Failed to create SDL window! SDL Error: %s\n", SDL_GetError());
-        else {
-            SDL_Renderer* renderer = nullptr;
-            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-
-            SDL_Event e;
-            bool quit = false;
-
-            interval = std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::system_clock::now().time_since_epoch())
-                           .count();
-
-            auto clock_interval = std::chrono::high_resolution_clock::now();
-            uint64_t seconds_interval = interval;
-
-            uint64_t instructions_executed = 0;
-            uint64_t frames_rendered = 0;
-
-            while (quit == false) {
-                while (SDL_PollEvent(&e)) {
-                    if (e.type == SDL_QUIT)
-                        quit = true;
-
-                    if (e.type == SDL_KEYUP || e.type == SDL_KEYDOWN) {
-                        bool isKeyPressed
-                            = e.type == SDL_KEYDOWN && e.type != SDL_KEYUP;
-
-                        switch (e.key.keysym.sym) {
-                        case SDLK_1:
-                            keyboard[1] = isKeyPressed;
-                            break;
-                        case SDLK_2:
-                            keyboard[2] = isKeyPressed;
-                            break;
-                        case SDLK_3:
-                            keyboard[3] = isKeyPressed;
-                            break;
-                        case SDLK_4:
-                            keyboard[0xC] = isKeyPressed;
-                            break;
-
-                        case SDLK_q:
-                            keyboard[4] = isKeyPressed;
-                            break;
-                        case SDLK_w:
-                            keyboard[5] = isKeyPressed;
-                            break;
-                        case SDLK_e:
-                            keyboard[6] = isKeyPressed;
-                            break;
-                        case SDLK_r:
-                            keyboard[0xD] = isKeyPressed;
-                            break;
-
-                        case SDLK_a:
-                            keyboard[7] = isKeyPressed;
-                            break;
-                        case SDLK_s:
-                            keyboard[8] = isKeyPressed;
-                            break;
-                        case SDLK_d:
-                            keyboard[9] = isKeyPressed;
-                            break;
-                        case SDLK_f:
-                            keyboard[0xE] = isKeyPressed;
-                            break;
-
-                        case SDLK_z:
-                            keyboard[0xA] = isKeyPressed;
-                            break;
-                        case SDLK_x:
-                            keyboard[0] = isKeyPressed;
-                            break;
-                        case SDLK_c:
-                            keyboard[0xB] = isKeyPressed;
-                            break;
-                        case SDLK_v:
-                            keyboard[0xF] = isKeyPressed;
-                            break;
-                        default:
-                            break;
-                        }
-                    }
-                }
+void Chip8::invalidateCode(uint16_t address)
+{
+    // The engines only cache code in the first 4 KiB; anything past that is
+    // XO-CHIP data, or runs through step().
+    if (address >= 4096)
+        return;
 
-                uint32_t opcode = (memory[PC] << 8) | memory[PC + 1];
-
-                uint8_t x = (opcode & 0x0F00) >> 8;
-                uint8_t y = (opcode & 0x00F0) >> 4;
-                uint8_t kk = (opcode & 0x00FF);
-                uint16_t nnn = opcode & 0x0FFF;
-
-                uint64_t now
-                    = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::system_clock::now().time_since_epoch())
-                          .count();
-
-                const std::chrono::duration<double> diff
-                    = std::chrono::high_resolution_clock::now()
-                    - clock_interval;
-
-                if (diff.count() >= 0.001666f) {
-                    switch (opcode & 0xF000) {
-                    case 0x0000: {
-                        // 00EE - RET
-                        // Return from a subroutine.
-                        if (opcode == 0x00EE) {
-                            if (SP == 0) {
-                                printf("Stack undeflow!\n");
-                                exit(1);
-                            }
-
-                            PC = stack[SP];
-                            --SP;
-                        } else {
-                            // 00E0 - CLS
-                            // Clear the display.
-                            if (opcode == 0x00E0) {
-                                memcpy(display[0].bits, display[1].bits,
-                                    32 * sizeof(uint64_t));
-                                for (int i = 0; i < 32; ++i)
-                                    display[1].bits[i] = 0ull;
-                            }
-
-                            PC += 2;
-                        }
-
-                        break;
-                    }
-
-                    // 1nnn - JP addr
-                    // Jump to location nnn.
-                    case 0x1000: {
-                        PC = nnn;
-                        break;
-                    }
-
-                    // 2nnn - CALL addr
-                    // Call subroutine at nnn.
-                    case 0x2000: {
-                        if (SP == 15) {
-                            printf("Stack overflow!\n");
-                            exit(1);
-                        }
-
-                        ++SP;
-                        stack[SP] = PC + 2;
-                        PC = nnn;
-                        break;
-                    }
-
-                    // 3xkk - SE Vx, byte
-                    // Skip next instruction if Vx = kk.
-                    case 0x3000: {
-                        PC += V[x] == kk ? 4 : 2;
-                        break;
-                    }
-
-                    // 4xkk - SNE Vx, byte
-                    // Skip next instruction if Vx != kk.
-                    case 0x4000: {
-                        PC += V[x] != kk ? 4 : 2;
-                        break;
-                    }
-
-                    // 5xy0 - SE Vx, Vy
-                    // Skip next instruction if Vx = Vy.
-                    case 0x5000: {
-                        PC += V[x] == V[y] ? 4 : 2;
-                        break;
-                    }
-
-                    // Cxkk - RND Vx, byte
-                    // Set Vx = random byte AND kk.
-                    case 0xC000: {
-                        uint8_t random = rand() % 255;
-                        V[x] = random & kk;
-                        PC += 2;
-                        break;
-                    }
-
-                    // Dxyn - DRW Vx, Vy, nibble
-                    // Display n-byte sprite starting at memory location I at
-                    // (Vx, Vy), set VF = collision.
-                    case 0xD000: {
-                        uint8_t n = opcode & 0x000F;
-
-                        memcpy(display[0].bits, display[1].bits,
-                            32 * sizeof(uint64_t));
-
-                        // printf("DRAW x: %d, y: %d, n: %d\n", V[x], V[y], n);
-
-                        V[0xF] = 0;
-
-                        int X = V[x] % 64;
-                        int Y = V[y] % 32;
-
-                        for (int i = 0; i < n; ++i) {
-                            uint64_t valueToXOR
-                                = ((uint64_t)(0ull | memory[I + i]) << 56) >> X;
-
-                            if (valueToXOR & display[1].bits[(Y + i) % 32])
-                                V[0xF] = 1;
-
-                            display[1].bits[Y + i] ^= valueToXOR;
-                        }
-
-                        PC += 2;
-                        break;
-                    }
-
-                    // 6xkk LD Vx, byte
-                    case 0x6000: {
-                        V[x] = kk;
-                        PC += 2;
-                        break;
-                    }
-
-                    // 7xkk - ADD Vx, byte
-                    // Set Vx = Vx + kk.
-                    case 0x7000: {
-                        V[x] += kk;
-                        PC += 2;
-                        break;
-                    }
-
-                    case 0x8000: {
-                        switch (opcode & 0x000F) {
-                        // 8xy0 - LD Vx, Vy
-                        // Set Vx = Vy.
-                        case 0: {
-                            V[x] = V[y];
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy1 - OR Vx, Vy
-                        // Set Vx = Vx OR Vy.
-                        case 1: {
-                            V[x] |= V[y];
-                            V[0xF] = 0;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy2 - AND Vx, Vy
-                        // Set Vx = Vx AND Vy.
-                        case 2: {
-                            V[x] &= V[y];
-                            V[0xF] = 0;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy3 - XOR Vx, Vy
-                        // Set Vx = Vx XOR Vy.
-                        case 3: {
-                            V[x] ^= V[y];
-                            V[0xF] = 0;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy4 - ADD Vx, Vy
-                        // Set Vx = Vx + Vy, set VF = carry.
-                        case 4: {
-                            uint8_t carry = (V[x] + V[y] > 255) ? 1 : 0;
-                            V[x] += V[y];
-                            V[0xF] = carry;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy5 - SUB Vx, Vy
-                        // Set Vx = Vx - Vy, set VF = NOT borrow.
-                        case 5: {
-                            uint8_t notBorrow = V[x] > V[y] ? 1 : 0;
-                            V[x] -= V[y];
-                            V[0xF] = notBorrow;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy6 - SHR Vx {, Vy}
-                        // Set Vx = Vx SHR 1.
-                        case 6: {
-                            uint8_t cutoffBit = V[x] & 1;
-                            V[x] = V[y];
-                            V[x] >>= 1;
-                            V[0xF] = cutoffBit;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xy7 - SUBN Vx, Vy
-                        // Set Vx = Vy - Vx, set VF = NOT borrow.
-                        case 7: {
-                            uint8_t notBorrow = V[y] > V[x] ? 1 : 0;
-                            V[x] = V[y] - V[x];
-                            V[0xF] = notBorrow;
-                            PC += 2;
-                            break;
-                        }
-
-                        // 8xyE - SHL Vx {, Vy}
-                        // Set Vx = Vx SHL 1.
-                        case 0xE: {
-                            uint8_t cutoffBit = V[x] >> 7;
-                            V[x] = V[y];
-                            V[x] <<= 1;
-                            V[0xF] = cutoffBit;
-                            PC += 2;
-                            break;
-                        }
-
-                        default: {
-                            THROW_UNRECOGNISED_OPCODE(opcode);
-                        }
-                        }
-
-                        break;
-                    }
-
-                    // 9xy0 - SNE Vx, Vy
-                    // Skip next instruction if Vx != Vy.
-                    case 0x9000: {
-                        PC += V[x] != V[y] ? 4 : 2;
-                        break;
-                    }
-
-                    // Annn - LD I, addr
-                    case 0xA000: {
-                        I = nnn;
-                        PC += 2;
-                        break;
-                    }
-
-                    // Bnnn - JP V0, addr
-                    // Jump to location nnn + V0.
-                    case 0xB000: {
-                        PC = nnn + V[0];
-                        break;
-                    }
-
-                    case 0xE000: {
-                        switch (opcode & 0x00FF) {
-                        // Ex9E - SKP Vx
-                        // Skip next instruction if key with the value of
-                        // Vx is pressed.
-                        case 0x009E: {
-                            if (keyboard[V[x]]) {
-                                PC += 2;
-                            }
-                            PC += 2;
-                            break;
-                        }
-
-                        // ExA1 - SKNP Vx
-                        // Skip next instruction if key with the value of
-                        // Vx is not pressed.
-                        case 0x00A1: {
-                            if (!keyboard[V[x]]) {
-                                PC += 2;
-                            }
-                            PC += 2;
-                            break;
-                        }
-
-                        default: {
-                            THROW_UNRECOGNISED_OPCODE(opcode);
-                        }
-                        }
-
-                        break;
-                    }
-
-                    case 0xF000: {
-                        switch (opcode & 0xF0FF) {
-                        // Fx07 - LD Vx, DT
-                        // Set Vx = delay timer value.
-                        case 0xF007: {
-                            V[x] = delayTimer;
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx0A - LD Vx, K
-                        // Wait for a key press, store the value of the key
-                        // in Vx.
-                        case 0xF00A: {
-                            for (int i = 0; i < 16; ++i) {
-                                if (keyboard[i] == true) {
-                                    V[x] = i;
-                                    printf("Key pressed: %01X\n", V[x]);
-                                    PC += 2;
-
-                                    break;
-                                }
-                            }
-
-                            break;
-                        }
-
-                        // Fx15 - LD DT, Vx
-                        // Set delay timer = Vx.
-                        case 0xF015: {
-                            delayTimer = V[x];
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx18 - LD ST, Vx
-                        // Set sound timer = Vx.
-                        case 0xF018: {
-                            soundTimer = V[x];
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx1E - ADD I, Vx
-                        // Set I = I + Vx.
-                        case 0xF01E: {
-                            I += V[x];
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx29 - LD F, Vx
-                        // Set I = location of sprite for digit Vx.
-                        case 0xF029: {
-                            I = x * 5;
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx33 - LD B, Vx
-                        // Store BCD representation of Vx in memory
-                        // locations I, I+1, and I+2.
-                        case 0xF033: {
-                            uint8_t o = V[x] % 10;
-                            uint8_t t = ((V[x] % 100) - o) / 10;
-                            uint8_t h = ((V[x] % 1000) - t - o) / 100;
-
-                            memory[I] = h;
-                            memory[I + 1] = t;
-                            memory[I + 2] = o;
-
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx55 - LD [I], Vx
-                        // Store registers V0 through Vx in memory starting
-                        // at location I.
-                        case 0xF055: {
-                            for (int i = 0; i <= x; ++i) {
-                                memory[I + i] = V[i];
-                            }
-                            I += x + 1;
-
-                            PC += 2;
-                            break;
-                        }
-
-                        // Fx65 - LD Vx, [I]
-                        // Read registers V0 through Vx from memory
-                        // starting at location I.
-                        case 0xF065: {
-                            for (int i = 0; i <= x; ++i) {
-                                V[i] = memory[I + i];
-                            }
-                            I += x + 1;
-
-                            PC += 2;
-                            break;
-                        }
-
-                        default: {
-                            THROW_UNRECOGNISED_OPCODE(opcode);
-                        }
-                        }
-
-                        break;
-                    }
-
-                    default: {
-                        printf("Invalid instruction! opcode: 0x%04X\n", opcode);
-                        exit(1);
-                    }
-                    }
-
-                    ++instructions_executed;
-                    clock_interval = std::chrono::high_resolution_clock::now();
-                }
+    if (predecoded)
+        invalidatePredecoded(address);
+#ifdef CHIP8_THREADED_DISPATCH
+    if (threaded)
+        invalidateThreaded(address);
+#endif
+#ifdef CHIP8_JIT
+    if (jit)
+        jit->invalidate(address);
+#endif
+}
 
-                if (now - interval >= 17) {
-                    if (delayTimer > 0)
-                        --delayTimer;
+uint64_t Chip8::stateHash() const
+{
+    // Rows hash to position-dependent values, so their XOR is a hash of the
+    // whole display.
+    uint64_t displayHash = 0;
+    for (int row = 0; row < Chip8Display::ROWS; ++row) {
+        if (staleRowHashes & (1ull << row)) {
+            uint64_t hash = mixHash(row + 1);
+            for (const Chip8Display& frame : display) {
+                for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+                    hash = mixHash(hash ^ frame.bits[plane][row][0]);
+                    hash = mixHash(hash ^ frame.bits[plane][row][1]);
+                }
+            }
+            rowHashes[row] = hash;
+        }
+        displayHash ^= rowHashes[row];
+    }
+    staleRowHashes = 0;
+
+    uint64_t hash = mixHash(memory.hash() ^ 0xCBF29CE484222325ull);
+    hash = mixHash(hash ^ displayHash);
+    hash = hashBytes(hash, V, sizeof(V));
+    hash = hashBytes(hash, stack, sizeof(stack));
+    hash = mixHash(hash ^ I ^ (uint64_t)PC << 16 ^ (uint64_t)SP << 32
+        ^ (uint64_t)delayTimer << 40 ^ (uint64_t)soundTimer << 48);
+    hash = mixHash(hash ^ hires ^ (uint64_t)planeMask << 8
+        ^ (uint64_t)pitch << 16);
+    hash = hashBytes(hash, flags, sizeof(flags));
+    hash = hashBytes(hash, audioPattern, sizeof(audioPattern));
+    return mixHash(hash ^ random.state);
+}
 
-                    ++frames_rendered;
-                    interval = now;
+void Chip8::tickTimers()
+{
+    if (delayTimer > 0)
+        --delayTimer;
+    if (soundTimer > 0)
+        --soundTimer;
+}
 
-                    rectangles.clear();
+Chip8Trap Chip8::runFrame(uint64_t instructionsPerFrame)
+{
+    if (runCycles(instructionsPerFrame) == Chip8Trap::None)
+        tickTimers();
+    return trap;
+}
 
-                    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-                    SDL_RenderClear(renderer);
-                    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+void Chip8::resetTo(const Chip8& pristine)
+{
+    memcpy(stack, pristine.stack, sizeof(stack));
+    memcpy(V, pristine.V, sizeof(V));
+    I = pristine.I;
+    PC = pristine.PC;
+    SP = pristine.SP;
+    delayTimer = pristine.delayTimer;
+    soundTimer = pristine.soundTimer;
+    trap = pristine.trap;
+    cycleCount = pristine.cycleCount;
+    memcpy(keyboard, pristine.keyboard, sizeof(keyboard));
+    memcpy(display, pristine.display, sizeof(display));
+    memcpy(rowHashes, pristine.rowHashes, sizeof(rowHashes));
+    staleRowHashes = pristine.staleRowHashes;
+    dirtyRows = ~0ull;
+    hires = pristine.hires;
+    planeMask = pristine.planeMask;
+    memcpy(flags, pristine.flags, sizeof(flags));
+    memcpy(audioPattern, pristine.audioPattern, sizeof(audioPattern));
+    pitch = pristine.pitch;
+    random = pristine.random;
+
+    for (int page = 0; page < Chip8Memory::PAGES; ++page)
+        restorePage(pristine.memory, page);
+}
 
-                    for (int displayRow = 0; displayRow < 32; ++displayRow) {
-                        for (int displayCol = 0; displayCol < 64;
-                             ++displayCol) {
-                            bool isPixelLit
-                                = ((display[1].bits[displayRow]
-                                       | display[0].bits[displayRow])
-                                      & (1ull << (63 - displayCol)))
-                                != 0;
+void Chip8::restorePage(const Chip8Memory& source, int page)
+{
+    if (!memory.sharePage(source, page)
+        || page * Chip8Memory::PAGE_SIZE >= 4096)
+        return;
+    for (int i = 0; i < Chip8Memory::PAGE_SIZE; ++i)
+        invalidateCode(page * Chip8Memory::PAGE_SIZE + i);
+}
 
-                            if (!isPixelLit)
-                                continue;
+const char* trapName(Chip8Trap trap)
+{
+    switch (trap) {
+    case Chip8Trap::None:
+        return "none";
+    case Chip8Trap::InvalidOpcode:
+        return "invalid-opcode";
+    case Chip8Trap::StackOverflow:
+        return "stack-overflow";
+    case Chip8Trap::StackUnderflow:
+        return "stack-underflow";
+    case Chip8Trap::UnsupportedOpcode:
+        return "unsupported-opcode";
+    }
+    return "unknown";
+}
 
-                            SDL_Rect r;
-                            r.h = 10;
-                            r.w = 10;
-                            r.x = displayCol * 10;
-                            r.y = displayRow * 10;
+const char* engineName(Chip8Engine engine)
+{
+    switch (engine) {
+    case Chip8Engine::Switch:
+        return "switch";
+    case Chip8Engine::Predecoded:
+        return "predecoded";
+#ifdef CHIP8_THREADED_DISPATCH
+    case Chip8Engine::Threaded:
+        return "threaded";
+#endif
+#ifdef CHIP8_JIT
+    case Chip8Engine::Jit:
+        return "jit";
+#endif
+    }
+    return "unknown";
+}
 
-                            rectangles.push_back(r);
-                        }
-                    }
+const std::vector<Chip8Engine>& availableEngines()
+{
+    static const std::vector<Chip8Engine> engines = {
+        Chip8Engine::Switch,
+        Chip8Engine::Predecoded,
+#ifdef CHIP8_THREADED_DISPATCH
+        Chip8Engine::Threaded,
+#endif
+#ifdef CHIP8_JIT
+        Chip8Engine::Jit,
+#endif
+    };
+    return engines;
+}
 
-                    SDL_RenderFillRects(
-                        renderer, rectangles.data(), rectangles.size());
-                    SDL_RenderPresent(renderer);
-                }
+bool parseEngineName(const std::string& name, Chip8Engine& engine)
+{
+    for (Chip8Engine candidate : availableEngines()) {
+        if (name == engineName(candidate)) {
+            engine = candidate;
+            return true;
+        }
+    }
+    return false;
+}
 
-                if (now - seconds_interval >= 1000) {
-                    printf("%d ", delayTimer);
-                    std::cout << instructions_executed << "Hz "
-                              << " " << frames_rendered << "fps" << std::endl;
+const std::vector<Chip8Profile>& availableProfiles()
+{
+    static const std::vector<Chip8Profile> profiles = {
+        Chip8Profile::Vip,
+        Chip8Profile::Chip48,
+        Chip8Profile::Schip,
+        Chip8Profile::XoChip,
+    };
+    return profiles;
+}
 
-                    frames_rendered = 0;
+const char* profileName(Chip8Profile profile)
+{
+    switch (profile) {
+    case Chip8Profile::Vip:
+        return "vip";
+    case Chip8Profile::Chip48:
+        return "chip48";
+    case Chip8Profile::Schip:
+        return "schip";
+    case Chip8Profile::XoChip:
+        return "xochip";
+    }
+    return "unknown";
+}
 
-                    seconds_interval = now;
-                    instructions_executed = 0;
+bool parseProfileName(const std::string& name, Chip8Profile& profile)
+{
+    for (Chip8Profile candidate : availableProfiles()) {
+        if (name == profileName(candidate)) {
+            profile = candidate;
+            return true;
+        }
+    }
+    return false;
+}
 
-                    if (delayTimer > 0) {
-                        --delayTimer;
-                    }
-                }
-            }
+const char* opcodeClassName(uint16_t opcode)
+{
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0)
+            return "00E0";
+        if (opcode == 0x00EE)
+            return "00EE";
+        if ((opcode & 0xFFF0) == 0x00C0)
+            return "00Cn";
+        if ((opcode & 0xFFF0) == 0x00D0)
+            return "00Dn";
+        switch (opcode) {
+        case 0x00FB:
+            return "00FB";
+        case 0x00FC:
+            return "00FC";
+        case 0x00FD:
+            return "00FD";
+        case 0x00FE:
+            return "00FE";
+        case 0x00FF:
+            return "00FF";
+        }
+        return "0nnn";
+    case 0x1000:
+        return "1nnn";
+    case 0x2000:
+        return "2nnn";
+    case 0x3000:
+        return "3xkk";
+    case 0x4000:
+        return "4xkk";
+    case 0x5000:
+        if ((opcode & 0x000F) == 0x2)
+            return "5xy2";
+        if ((opcode & 0x000F) == 0x3)
+            return "5xy3";
+        return "5xy0";
+    case 0x6000:
+        return "6xkk";
+    case 0x7000:
+        return "7xkk";
+    case 0x8000: {
+        static const char* const names[16] = { "8xy0", "8xy1", "8xy2", "8xy3",
+            "8xy4", "8xy5", "8xy6", "8xy7", "8xy?", "8xy?", "8xy?", "8xy?",
+            "8xy?", "8xy?", "8xyE", "8xy?" };
+        return names[opcode & 0x000F];
+    }
+    case 0x9000:
+        return "9xy0";
+    case 0xA000:
+        return "Annn";
+    case 0xB000:
+        return "Bnnn";
+    case 0xC000:
+        return "Cxkk";
+    case 0xD000:
+        return (opcode & 0x000F) == 0 ? "Dxy0" : "Dxyn";
+    case 0xE000:
+        if ((opcode & 0x00FF) == 0x009E)
+            return "Ex9E";
+        if ((opcode & 0x00FF) == 0x00A1)
+            return "ExA1";
+        return "Ex??";
+    default:
+        if (opcode == 0xF000)
+            return "F000";
+        if (opcode == 0xF002)
+            return "F002";
+        switch (opcode & 0x00FF) {
+        case 0x01:
+            return "Fn01";
+        case 0x07:
+            return "Fx07";
+        case 0x0A:
+            return "Fx0A";
+        case 0x15:
+            return "Fx15";
+        case 0x18:
+            return "Fx18";
+        case 0x1E:
+            return "Fx1E";
+        case 0x29:
+            return "Fx29";
+        case 0x30:
+            return "Fx30";
+        case 0x3A:
+            return "Fx3A";
+        case 0x33:
+            return "Fx33";
+        case 0x55:
+            return "Fx55";
+        case 0x65:
+            return "Fx65";
+        case 0x75:
+            return "Fx75";
+        case 0x85:
+            return "Fx85";
+        default:
+            return "Fx??";
         }
     }
 }
@@ -1,54 +1,188 @@
 #pragma once
 
-#include <SDL_render.h>
+#include "chip8_memory.h"
+#include "chip8_quirks.h"
+#include "chip8_random.h"
+#include "chip8_rom.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+// Instructions executed per 60Hz frame, i.e. per timer tick, unless
+// configured otherwise: 600 instructions per second, roughly the speed of the
+// original interpreters. Headless runs use the same ratio so that ROMs which
+// wait on the delay timer behave identically.
+constexpr int DEFAULT_INSTRUCTIONS_PER_FRAME = 10;
+
+// Up to 128x64 pixels in two bitplanes. Every row is a pair of words with
+// the leftmost pixel in the top bit of the first, so sprite draws and scrolls
+// are a few word-wide shifts. In the 64x32 low-resolution mode only the first
+// word of the first 32 rows of each plane is used.
+struct Chip8Display
+{
+    static constexpr int PLANES = 2;
+    static constexpr int ROWS = 64;
+    // Words in the whole display, for code that treats it as one array.
+    static constexpr int WORDS = PLANES * ROWS * 2;
+
+    uint64_t bits[PLANES][ROWS][2];
+};
+
+// The interpreter implementations runCycles() can execute with. They all have
+// identical observable behaviour and differ only in speed.
+enum class Chip8Engine
+{
+    // Fetch and decode every instruction, dispatch through a switch.
+    Switch,
+    // Dispatch through a cache of already-decoded instructions.
+    Predecoded,
+#ifdef CHIP8_THREADED_DISPATCH
+    // Like Predecoded, but every handler jumps straight to the next one
+    // through a computed goto. Needs GCC or Clang; see CMakeLists.txt.
+    Threaded,
+#endif
+#ifdef CHIP8_JIT
+    // Translate basic blocks to x86-64 and run them natively. See
+    // chip8_jit.h.
+    Jit,
+#endif
+};
+
+#ifdef CHIP8_THREADED_DISPATCH
+constexpr Chip8Engine DEFAULT_ENGINE = Chip8Engine::Threaded;
+#else
+constexpr Chip8Engine DEFAULT_ENGINE = Chip8Engine::Switch;
+#endif
+
+// Every engine compiled into this build.
+const std::vector<Chip8Engine>& availableEngines();
+
+const char* engineName(Chip8Engine engine);
+bool parseEngineName(const std::string& name, Chip8Engine& engine);
 
-struct Chip8SDLDisplay
+// Why a machine stopped. A faulting instruction leaves PC on itself and sets
+// Chip8::trap, and runCycles() returns without executing anything more until
+// the trap is cleared, e.g. by loading a state.
+enum class Chip8Trap : uint8_t
 {
-    uint64_t bits[32];
-    SDL_Window* window;
-    SDL_Surface* screenSurface;
-    SDL_Renderer* renderer;
-    int width, height;
+    None,
+    // An opcode that isn't an instruction in any profile.
+    InvalidOpcode,
+    // 2nnn with all 16 stack levels in use.
+    StackOverflow,
+    // 00EE with nothing to return to.
+    StackUnderflow,
+    // An instruction, or a memory access, outside what the engine models.
+    // Only the lockstep engine (chip8_lockstep.h) raises it.
+    UnsupportedOpcode,
 };
 
+const char* trapName(Chip8Trap trap);
+
+struct Chip8Instruction;
+struct Chip8DecodedInstruction;
+struct Chip8ThreadedInstruction;
+class Chip8Jit;
+#ifdef CHIP8_INSTRUMENT
+class Chip8Stats;
+#endif
+
+// The interpreter core. It owns the machine state and executes instructions,
+// but knows nothing about windows, input devices or wall-clock time; pacing,
+// rendering and the keyboard are the job of a frontend (see sdl_frontend.h).
 class Chip8
 {
 public:
-    explicit Chip8(const std::string& romFilepath);
-    void run();
+    // Cxkk's random numbers are drawn from a generator seeded with seed, so
+    // two machines with the same ROM, seed and profile behave identically.
+    // profile selects the quirks the ROM expects (see chip8_quirks.h). An
+    // empty romFilepath gives a machine with no ROM loaded.
+    explicit Chip8(const std::string& romFilepath,
+        uint64_t seed = DEFAULT_RANDOM_SEED,
+        Chip8Profile profile = DEFAULT_PROFILE);
+    ~Chip8();
 
-private:
-    void clearMemory();
-    void loadROMFileFromPath(const std::string& romFilepath);
-    void drawDisplayToTerminal();
+    // A new machine in exactly this one's state, sharing its memory pages
+    // copy-on-write (see chip8_memory.h). Only the registers, the display and
+    // the page table are copied, which takes around a microsecond; the
+    // engines' caches are rebuilt on first use.
+    std::unique_ptr<Chip8> fork() const;
 
-    uint64_t interval = 0;
+    // Fetch, decode and execute the instruction at PC.
+    void step();
 
-    /* Memory Map:
-      +---------------+= 0xFFF (4095) End of Chip-8 RAM
-      |               |
-      |               |
-      |               |
-      |               |
-      |               |
-      | 0x200 to 0xFFF|
-      |     Chip-8    |
-      | Program / Data|
-      |     Space     |
-      |               |
-      |               |
-      |               |
-      +- - - - - - - -+= 0x600 (1536) Start of ETI 660 Chip-8 programs
-      |               |
-      |               |
-      |               |
-      +---------------+= 0x200 (512) Start of most Chip-8 programs
-      | 0x000 to 0x1FF|
-      | Reserved for  |
-      |  interpreter  |
-      +---------------+= 0x000 (0) Start of Chip-8 RAM */
-    uint8_t memory[4096];
+    // Execute n instructions back-to-back, as fast as the host allows, or
+    // fewer if one of them traps. Returns the machine's trap, if any.
+    Chip8Trap runCycles(uint64_t n);
+
+    // Select the engine runCycles() uses. Defaults to DEFAULT_ENGINE.
+    void setEngine(Chip8Engine engine);
+
+    // Whether runCycles() fast-forwards through idle loops: Fx0A waiting for
+    // a key, a jump to itself and the Fx07 / 3xkk / 1nnn delay timer poll.
+    // The machine ends up in exactly the state executing them would leave it
+    // in. On by default; benchmarks of the engines themselves turn it off.
+    void setIdleSkipping(bool enabled) { idleSkipping = enabled; }
+
+    // The quirk profile the machine was loaded with.
+    Chip8Profile profile() const { return quirksProfile; }
+
+    // Write a byte of memory, keeping any cached translations of it in sync.
+    // Instructions that store to memory must go through here.
+    void storeMemory(uint16_t address, uint8_t value);
+
+    // A 64-bit digest of the whole machine state: memory, registers, stack,
+    // timers, display and random number generator. Equal states have equal
+    // hashes, and different states almost never do, so the hash can stand in
+    // for the state, e.g. to find machines in the same state or a run that
+    // has come back to an earlier one.
+    //
+    // Memory's hash is kept up to date by every store, and the display's by
+    // row as rows change, so this costs well under a microsecond rather than
+    // a pass over 64 KiB. It updates cached row hashes, so calls on the same
+    // machine must not race.
+    uint64_t stateHash() const;
+
+    // Serialise the whole machine state into a compact, versioned snapshot
+    // (see chip8_state.cpp). Memory is stored as its differences from the
+    // image the ROM loaded as, so snapshots are typically a few hundred bytes.
+    std::vector<uint8_t> saveState() const;
+
+    // Restore a snapshot taken by saveState() on a machine running the same
+    // ROM with the same quirk profile. Returns false, leaving the machine
+    // untouched, if the snapshot is malformed, from another format version,
+    // or from another ROM or profile. Snapshots don't record traps, so
+    // loading one clears any trap.
+    bool loadState(const std::vector<uint8_t>& snapshot);
+
+    // Advance the delay and sound timers by one 60Hz tick.
+    void tickTimers();
+
+    // Execute one frame's worth of instructions, then tick the timers unless
+    // the machine trapped. Returns the machine's trap, if any.
+    Chip8Trap runFrame(
+        uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME);
+
+    // Put this machine back into pristine's state, which must be a machine of
+    // the same ROM and profile, e.g. one forked from this one before it ran.
+    // Only memory pages that differ from pristine's are touched, and only the
+    // engines' cached code on those pages is dropped, so resetting a machine
+    // that ran briefly costs about as much as a fork. The engine and idle
+    // skipping setting are kept.
+    void resetTo(const Chip8& pristine);
+
+    // The registers, stack and cycle count are what every instruction
+    // touches, so they are packed into the first 64-byte cache line of the
+    // machine (see chip8_pool.h); memory, the keyboard and the display follow
+    // on lines of their own.
+
+    // The stack is an array of 16 16-bit values, used to store the address that
+    // the interpreter shoud return to when finished with a subroutine. Chip-8
+    // allows for up to 16 levels of nested subroutines.
+    alignas(64) uint16_t stack[16];
 
     // Chip-8 has 16 general purpose 8-bit registers, usually referred to as Vx,
     // where x is a hexadecimal digit (0 through F).
@@ -59,6 +193,14 @@ private:
     // usually used.
     uint16_t I;
 
+    // The program counter (PC) should be 16-bit, and is used to store the
+    // currently executing address.
+    uint16_t PC;
+
+    // The stack pointer (SP) can be 8-bit, it is used to point to the topmost
+    // level of the stack.
+    uint8_t SP;
+
     /*
       Chip-8 provides 2 timers, a delay timer and a sound timer.
     */
@@ -77,18 +219,45 @@ private:
     // frequency of this tone is decided by the author of the interpreter.
     uint8_t soundTimer;
 
-    // The program counter (PC) should be 16-bit, and is used to store the
-    // currently executing address.
-    uint16_t PC;
+    // Set by an instruction that faulted; see Chip8Trap.
+    Chip8Trap trap;
 
-    // The stack pointer (SP) can be 8-bit, it is used to point to the topmost
-    // level of the stack.
-    uint8_t SP;
+    // Instructions executed by runCycles() since construction, counting one
+    // that trapped but none after it. Input movies (see chip8_movie.h) key
+    // their events on it.
+    uint64_t cycleCount;
 
-    // The stack is an array of 16 16-bit values, used to store the address that
-    // the interpreter shoud return to when finished with a subroutine. Chip-8
-    // allows for up to 16 levels of nested subroutines.
-    uint16_t stack[16];
+    /* Memory Map:
+      +---------------+= 0xFFFF (65535) End of XO-CHIP RAM
+      |               |
+      |  XO-CHIP data |
+      |               |
+      +---------------+= 0xFFF (4095) End of Chip-8 RAM
+      |               |
+      |               |
+      |               |
+      |               |
+      |               |
+      | 0x200 to 0xFFF|
+      |     Chip-8    |
+      | Program / Data|
+      |     Space     |
+      |               |
+      |               |
+      |               |
+      +- - - - - - - -+= 0x600 (1536) Start of ETI 660 Chip-8 programs
+      |               |
+      |               |
+      |               |
+      +---------------+= 0x200 (512) Start of most Chip-8 programs
+      | 0x000 to 0x1FF|
+      | Reserved for  |
+      |  interpreter  |
+      +---------------+= 0x000 (0) Start of Chip-8 RAM
+
+      The interpreter area holds the 4x5 font at 0x000 and the SUPER-CHIP
+      8x10 font at 0x050. */
+    alignas(64) Chip8Memory memory;
 
     /*
       The computers which originally used the Chip-8 Language had a 16-key
@@ -118,8 +287,160 @@ private:
           |                    |
           |(0, 31)     (63, 31)|
           ----------------------
+
+      SUPER-CHIP added a 128x64 high-resolution mode, and XO-CHIP a second
+      bitplane, so that every pixel can be one of four colours.
     */
-    Chip8SDLDisplay display[2];
+    alignas(64) Chip8Display display[2];
+
+    // Bit n is set when row n of what a frontend presents, display[0] |
+    // display[1], may have changed. The core only ever sets bits, through
+    // markRowsChanged(); a frontend clears them once it has presented the
+    // rows.
+    uint64_t dirtyRows;
+
+    // Record that the rows set in rows may have changed, in either frame.
+    // Anything that writes to display must call this.
+    void markRowsChanged(uint64_t rows)
+    {
+        dirtyRows |= rows;
+        staleRowHashes |= rows;
+    }
+
+    // Set by 00FF and cleared by 00FE: whether the display is 128x64 rather
+    // than 64x32.
+    bool hires;
+
+    // The bitplanes that drawing, clearing and scrolling affect, set by
+    // XO-CHIP's Fn01. Bit n selects plane n.
+    uint8_t planeMask;
+
+    // SUPER-CHIP's user flags (the HP-48's RPL flags), saved and restored by
+    // Fx75 and Fx85.
+    uint8_t flags[16];
+
+    // XO-CHIP's 128-sample, 1-bit audio pattern, loaded by F002, and its
+    // playback pitch, set by Fx3A. The buzzer plays it while the sound timer
+    // is non-zero.
+    uint8_t audioPattern[16];
+    uint8_t pitch;
+
+    // Source of Cxkk's random bytes. Each machine has its own, so that
+    // instances can run on separate threads without sharing any state.
+    Chip8Random random;
+
+#ifdef CHIP8_INSTRUMENT
+    // Where runCycles() counts the instructions it executes, if set (see
+    // chip8_stats.h). While counting, every engine runs as the switch engine
+    // does, one instruction at a time, so the counts don't depend on which
+    // engine is selected.
+    Chip8Stats* stats = nullptr;
+#endif
+
+private:
+    friend class Chip8Pool;
+
+    // For fork(): copies everything but the engines' caches.
+    Chip8(const Chip8& parent);
+
+    // Memory as it was right after the ROM was loaded; save states are
+    // stored relative to it. Shared with every other machine running the
+    // same ROM (see chip8_rom.h).
+    std::shared_ptr<const Chip8MemoryImage> romImage;
+
+    Chip8Profile quirksProfile;
+
+    // A hash of each row of the display, both frames and both planes, for
+    // stateHash(); those of rows marked in staleRowHashes are out of date.
+    mutable uint64_t rowHashes[Chip8Display::ROWS];
+    mutable uint64_t staleRowHashes = ~0ull;
+
+    // How often runCycles() looks for an idle loop, in instructions.
+    static constexpr uint64_t IDLE_CHECK_INTERVAL = 1024;
+
+    bool idleSkipping = true;
+
+    // Execute n instructions on the selected engine, or up to and including
+    // one that traps. Returns how many were executed.
+    uint64_t runEngine(uint64_t n);
+
+    uint16_t opcodeAt(uint16_t address) const;
+
+    // Drop the engines' cached translations of the byte at address.
+    void invalidateCode(uint16_t address);
+
+    // Make page of memory source's page again, sharing it, and drop the
+    // engines' translations of it if that changed anything.
+    void restorePage(const Chip8Memory& source, int page);
+
+    // If PC is in an idle loop that the next n instructions can't leave,
+    // leave the machine as executing them would and return true.
+    bool skipIdleLoop(uint64_t n);
+
+    uint64_t runPredecoded(uint64_t n);
+    void invalidatePredecoded(uint16_t address);
+    static void decodePredecoded(Chip8& c, const Chip8Instruction& in);
+
+    Chip8Engine engine = DEFAULT_ENGINE;
+
+    // One entry per even address in memory, allocated on first use of
+    // Chip8Engine::Predecoded. Instructions at odd addresses aren't cached.
+    std::unique_ptr<Chip8DecodedInstruction[]> predecoded;
+
+#ifdef CHIP8_THREADED_DISPATCH
+    uint64_t runThreaded(uint64_t n);
+    template <Chip8Quirks Quirks>
+    uint64_t runThreadedWith(uint64_t n);
+    void invalidateThreaded(uint16_t address);
+
+    // The same, for Chip8Engine::Threaded.
+    std::unique_ptr<Chip8ThreadedInstruction[]> threaded;
+    // The label of entries that haven't been decoded yet, inside this
+    // machine's profile's instantiation of runThreadedWith().
+    const void* threadedDecodeLabel = nullptr;
+#endif
+
+#ifdef CHIP8_JIT
+    // Created on first use of Chip8Engine::Jit.
+    std::unique_ptr<Chip8Jit> jit;
+#endif
+};
+
+// The fields declared before memory must stay on the machine's first cache
+// line (see chip8_pool.h). Chip8 isn't standard-layout, which makes offsetof
+// conditionally supported; GCC and Clang support it for a class without
+// virtual bases.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+static_assert(offsetof(Chip8, stack) == 0,
+    "Chip8's stack must start its first cache line");
+static_assert(offsetof(Chip8, cycleCount) + sizeof(uint64_t) <= 64,
+    "Chip8's registers and cycle count must fit its first cache line");
+#pragma GCC diagnostic pop
+
+// Short name of the instruction class an opcode belongs to, e.g. "8xy4".
+const char* opcodeClassName(uint16_t opcode);
+
+// Where the SUPER-CHIP 8x10 font starts in memory; Fx30 points I into it.
+constexpr uint16_t BIG_FONT_START = 0x050;
+
+const uint8_t BIG_NUMBER_SPRITES[16][10] = {
+    { 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF },
+    { 0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF },
+    { 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03 },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18 },
+    { 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF },
+    { 0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3 },
+    { 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC },
+    { 0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C },
+    { 0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0 },
 };
 
 const uint8_t NUMBER_SPRITES[16][5]
@@ -0,0 +1,162 @@
+#include "chip8_frames.h"
+
+#include <cstring>
+
+static constexpr char Y4M_FRAME_HEADER[] = "FRAME\n";
+
+// Grey levels of a pixel by which planes it is set in.
+static constexpr uint8_t GREYS[4] = { 0x00, 0xFF, 0x55, 0xAA };
+
+// Keep every other bit of a 64-bit word, starting from the top one: the
+// inverse of widenPixels().
+static uint32_t narrowPixels(uint64_t bits)
+{
+    uint64_t x = (bits >> 1) & 0x5555555555555555ull;
+    x = (x | x >> 1) & 0x3333333333333333ull;
+    x = (x | x >> 2) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | x >> 4) & 0x00FF00FF00FF00FFull;
+    x = (x | x >> 8) & 0x0000FFFF0000FFFFull;
+    return x | x >> 16;
+}
+
+// Row row of plane in a stream width pixels wide, leftmost pixel in the top
+// bit of out[0]. Only out[0] is used at 64 pixels.
+static void streamRow(const Chip8& machine, int plane, int row, int width,
+    uint64_t out[2])
+{
+    const auto& bits = machine.display[1].bits[plane];
+    if (width == 128) {
+        if (machine.hires) {
+            out[0] = bits[row][0];
+            out[1] = bits[row][1];
+        } else {
+            out[0] = widenPixels(bits[row / 2][0] >> 32);
+            out[1] = widenPixels(bits[row / 2][0]);
+        }
+    } else {
+        if (machine.hires) {
+            out[0] = (uint64_t)narrowPixels(bits[row * 2][0]) << 32
+                | narrowPixels(bits[row * 2][1]);
+        } else
+            out[0] = bits[row][0];
+        out[1] = 0;
+    }
+}
+
+const char* frameFormatName(Chip8FrameFormat format)
+{
+    switch (format) {
+    case Chip8FrameFormat::Raw:
+        return "raw";
+    case Chip8FrameFormat::Y4m:
+        return "y4m";
+    }
+    return "unknown";
+}
+
+bool parseFrameFormatName(const std::string& name, Chip8FrameFormat& format)
+{
+    for (Chip8FrameFormat candidate :
+        { Chip8FrameFormat::Raw, Chip8FrameFormat::Y4m }) {
+        if (name == frameFormatName(candidate)) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+Chip8FrameWriter::Chip8FrameWriter(
+    Chip8FrameFormat format, bool highResolution)
+    : format(format)
+    , width(highResolution ? 128 : 64)
+    , height(highResolution ? 64 : 32)
+    , frameSize(format == Chip8FrameFormat::Raw
+              ? width * height / 8
+              : sizeof(Y4M_FRAME_HEADER) - 1 + width * height)
+{
+    buffer.reserve(BUFFER_SIZE);
+}
+
+Chip8FrameWriter::~Chip8FrameWriter() { close(); }
+
+bool Chip8FrameWriter::open(const std::string& path)
+{
+    close();
+    failed = false;
+    frameCount = 0;
+
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    // Everything goes through our own buffer already.
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    if (format == Chip8FrameFormat::Y4m) {
+        char header[64];
+        const int length = snprintf(header, sizeof(header),
+            "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", width, height);
+        buffer.insert(buffer.end(), header, header + length);
+    }
+    return true;
+}
+
+void Chip8FrameWriter::write(const Chip8& machine)
+{
+    if (file == nullptr)
+        return;
+    if (buffer.size() + frameSize > BUFFER_SIZE)
+        flush();
+
+    const size_t start = buffer.size();
+    buffer.resize(start + frameSize);
+    uint8_t* out = buffer.data() + start;
+
+    if (format == Chip8FrameFormat::Y4m) {
+        memcpy(out, Y4M_FRAME_HEADER, sizeof(Y4M_FRAME_HEADER) - 1);
+        out += sizeof(Y4M_FRAME_HEADER) - 1;
+    }
+
+    const int words = width / 64;
+    for (int row = 0; row < height; ++row) {
+        uint64_t planes[Chip8Display::PLANES][2];
+        for (int plane = 0; plane < Chip8Display::PLANES; ++plane)
+            streamRow(machine, plane, row, width, planes[plane]);
+
+        for (int word = 0; word < words; ++word) {
+            const uint64_t first = planes[0][word];
+            const uint64_t second = planes[1][word];
+            if (format == Chip8FrameFormat::Raw) {
+                const uint64_t lit = first | second;
+                for (int shift = 56; shift >= 0; shift -= 8)
+                    *out++ = lit >> shift;
+            } else {
+                for (int shift = 63; shift >= 0; --shift) {
+                    *out++ = GREYS[((first >> shift) & 1)
+                        | ((second >> shift) & 1) << 1];
+                }
+            }
+        }
+    }
+
+    ++frameCount;
+}
+
+void Chip8FrameWriter::flush()
+{
+    if (!buffer.empty()
+        && fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+        failed = true;
+    buffer.clear();
+}
+
+bool Chip8FrameWriter::close()
+{
+    if (file == nullptr)
+        return !failed;
+
+    flush();
+    failed |= fclose(file) != 0;
+    file = nullptr;
+    return !failed;
+}
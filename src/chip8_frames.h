@@ -0,0 +1,87 @@
+#pragma once
+
+// Streams a machine's frames to a file or pipe, for encoding into video or
+// diffing against a known-good run offline.
+//
+// Every call to write() appends the display as it is now, display[1] with
+// both planes combined, in one of two formats:
+//
+//   Raw  1 bit per pixel, rows top to bottom, the leftmost pixel in the top
+//        bit of each byte, and nothing between frames: 256 bytes per 64x32
+//        frame, 1024 per 128x64 one.
+//   Y4m  A YUV4MPEG2 stream of 8-bit greyscale (Cmono) frames at 60fps, which
+//        ffmpeg reads directly. XO-CHIP's four colours are four greys.
+//
+// A stream's frames are all the same size, picked when it is opened. In a
+// 128x64 stream, 64x32 frames have every pixel doubled; in a 64x32 stream,
+// 128x64 frames keep the top-left pixel of every 2x2 block.
+//
+// Frames are gathered in a large buffer and written out in big blocks, so
+// dumping every frame doesn't hold back a turbo-speed run.
+
+#include "chip8.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum class Chip8FrameFormat
+{
+    Raw,
+    Y4m,
+};
+
+const char* frameFormatName(Chip8FrameFormat format);
+bool parseFrameFormatName(const std::string& name, Chip8FrameFormat& format);
+
+// Double every bit of a 32-bit word into a 64-bit one, for showing a 64x32
+// row at 128x64.
+inline uint64_t widenPixels(uint32_t bits)
+{
+    uint64_t x = bits;
+    x = (x | x << 16) & 0x0000FFFF0000FFFFull;
+    x = (x | x << 8) & 0x00FF00FF00FF00FFull;
+    x = (x | x << 4) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | x << 2) & 0x3333333333333333ull;
+    x = (x | x << 1) & 0x5555555555555555ull;
+    return x | x << 1;
+}
+
+class Chip8FrameWriter
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    Chip8FrameWriter(Chip8FrameFormat format, bool highResolution);
+    ~Chip8FrameWriter();
+
+    Chip8FrameWriter(const Chip8FrameWriter&) = delete;
+    Chip8FrameWriter& operator=(const Chip8FrameWriter&) = delete;
+
+    // Start a stream at path, which may be a named pipe. Returns false if it
+    // can't be opened.
+    bool open(const std::string& path);
+
+    // Append machine's current frame.
+    void write(const Chip8& machine);
+
+    // Write out what's buffered and close the stream. Returns false if any
+    // write failed along the way.
+    bool close();
+
+    uint64_t frames() const { return frameCount; }
+
+private:
+    void flush();
+
+    const Chip8FrameFormat format;
+    const int width;
+    const int height;
+    const size_t frameSize;
+
+    FILE* file = nullptr;
+    std::vector<uint8_t> buffer;
+    uint64_t frameCount = 0;
+    bool failed = false;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+// The mixing behind Chip8::stateHash() and the memory and display hashes it
+// is assembled from.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Scramble a word so that every input bit affects every output bit. A
+// bijection, so distinct words never collide. (SplitMix64's finaliser.)
+inline uint64_t mixHash(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Fold the size bytes at data into hash, a word at a time.
+inline uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = mixHash(hash ^ word);
+    }
+    if (size > 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, size);
+        hash = mixHash(hash ^ word);
+    }
+    return hash;
+}
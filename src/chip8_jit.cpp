@@ -0,0 +1,580 @@
+#include "chip8_jit.h"
+#include "chip8.h"
+#include "chip8_ops.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Translated blocks are called as void block(Chip8* c). They keep the machine
+// pointer in rbx for their whole body and address the registers relative to
+// it, so all that needs saving is rbx itself.
+enum Reg8
+{
+    AL = 0,
+    CL = 1,
+    DL = 2,
+};
+
+class X86Emitter
+{
+public:
+    explicit X86Emitter(std::vector<uint8_t>& code)
+        : code(code)
+    {
+    }
+
+    void byte(uint8_t b) { code.push_back(b); }
+
+    void imm16(uint16_t v)
+    {
+        byte(v & 0xFF);
+        byte(v >> 8);
+    }
+
+    void imm32(int32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            byte((uint32_t)v >> (8 * i));
+    }
+
+    void imm64(uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            byte(v >> (8 * i));
+    }
+
+    // ModRM for [rbx + disp32] with the given reg field.
+    void rbxDisp(int reg, int32_t disp)
+    {
+        byte(0x80 | (reg << 3) | 3);
+        imm32(disp);
+    }
+
+    // push rbx; mov rbx, rdi
+    void prologue()
+    {
+        byte(0x53);
+        byte(0x48);
+        byte(0x89);
+        byte(0xFB);
+    }
+
+    // pop rbx; ret
+    void epilogue()
+    {
+        byte(0x5B);
+        byte(0xC3);
+    }
+
+    // mov r8, byte [rbx + disp]
+    void load8(Reg8 reg, int32_t disp)
+    {
+        byte(0x8A);
+        rbxDisp(reg, disp);
+    }
+
+    // mov byte [rbx + disp], r8
+    void store8(int32_t disp, Reg8 reg)
+    {
+        byte(0x88);
+        rbxDisp(reg, disp);
+    }
+
+    // mov byte [rbx + disp], imm8
+    void store8Imm(int32_t disp, uint8_t value)
+    {
+        byte(0xC6);
+        rbxDisp(0, disp);
+        byte(value);
+    }
+
+    // add byte [rbx + disp], imm8
+    void add8Imm(int32_t disp, uint8_t value)
+    {
+        byte(0x80);
+        rbxDisp(0, disp);
+        byte(value);
+    }
+
+    // <op> al, byte [rbx + disp], for op in add (0x02), or (0x0A),
+    // and (0x22), xor (0x32)
+    void aluAlMem(uint8_t opcode, int32_t disp)
+    {
+        byte(opcode);
+        rbxDisp(AL, disp);
+    }
+
+    // cmp al, dl
+    void cmpAlDl()
+    {
+        byte(0x38);
+        byte(0xD0);
+    }
+
+    // sub al, dl
+    void subAlDl()
+    {
+        byte(0x28);
+        byte(0xD0);
+    }
+
+    // setc cl
+    void setcCl()
+    {
+        byte(0x0F);
+        byte(0x92);
+        byte(0xC1);
+    }
+
+    // seta cl
+    void setaCl()
+    {
+        byte(0x0F);
+        byte(0x97);
+        byte(0xC1);
+    }
+
+    // and cl, imm8
+    void andClImm(uint8_t value)
+    {
+        byte(0x80);
+        byte(0xE1);
+        byte(value);
+    }
+
+    // shr cl, imm8
+    void shrClImm(uint8_t value)
+    {
+        byte(0xC0);
+        byte(0xE9);
+        byte(value);
+    }
+
+    // shr al, 1
+    void shrAl1()
+    {
+        byte(0xD0);
+        byte(0xE8);
+    }
+
+    // shl al, 1
+    void shlAl1()
+    {
+        byte(0xD0);
+        byte(0xE0);
+    }
+
+    // mov word [rbx + disp], imm16
+    void store16Imm(int32_t disp, uint16_t value)
+    {
+        byte(0x66);
+        byte(0xC7);
+        rbxDisp(0, disp);
+        imm16(value);
+    }
+
+    // movzx eax, byte [rbx + disp]; add word [rbx + disp16], ax
+    void add16FromByte(int32_t disp16, int32_t disp8)
+    {
+        byte(0x0F);
+        byte(0xB6);
+        rbxDisp(AL, disp8);
+        byte(0x66);
+        byte(0x01);
+        rbxDisp(AL, disp16);
+    }
+
+    // mov rdi, rbx; mov rax, function; call rax
+    void callWithMachine(void (*function)(Chip8*))
+    {
+        byte(0x48);
+        byte(0x89);
+        byte(0xDF);
+        byte(0x48);
+        byte(0xB8);
+        imm64((uint64_t)function);
+        byte(0xFF);
+        byte(0xD0);
+    }
+
+private:
+    std::vector<uint8_t>& code;
+};
+
+// Instructions that aren't translated run through the interpreter, in its
+// instantiation for the machine's quirk profile.
+template <Chip8Quirks Quirks>
+static void interpretOne(Chip8* c)
+{
+    stepInstruction<Quirks>(*c);
+}
+
+// Whether execution can continue past this instruction to the next one in
+// memory. Stores end a block too, since they may overwrite the block itself,
+// and so does every instruction that can trap, which run() relies on.
+static bool endsBlock(uint16_t opcode)
+{
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        // 00FD leaves PC where it is.
+        return opcode == 0x00EE || opcode == 0x00FD;
+    case 0x1000:
+    case 0x2000:
+    case 0x3000:
+    case 0x4000:
+    case 0x5000:
+    case 0x9000:
+    case 0xB000:
+    case 0xE000:
+        return true;
+    case 0x8000:
+        switch (opcode & 0x000F) {
+        case 0x0:
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x6:
+        case 0x7:
+        case 0xE:
+            return false;
+        default:
+            return true;
+        }
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x07:
+        case 0x15:
+        case 0x18:
+        case 0x1E:
+        case 0x29:
+        case 0x30:
+        case 0x65:
+            return false;
+        default:
+            return true;
+        }
+    default:
+        return false;
+    }
+}
+
+Chip8Jit::Chip8Jit(Chip8& c)
+    : c(c)
+    , quirks(quirksOf(c.profile()))
+{
+    visitQuirks(c.profile(),
+        [this]<Chip8Quirks Quirks>() { interpret = interpretOne<Quirks>; });
+
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(&c);
+    offsetV = reinterpret_cast<const uint8_t*>(c.V) - base;
+    offsetI = reinterpret_cast<const uint8_t*>(&c.I) - base;
+    offsetPC = reinterpret_cast<const uint8_t*>(&c.PC) - base;
+    offsetDelayTimer = reinterpret_cast<const uint8_t*>(&c.delayTimer) - base;
+    offsetSoundTimer = reinterpret_cast<const uint8_t*>(&c.soundTimer) - base;
+
+    invalidateAll();
+}
+
+Chip8Jit::~Chip8Jit()
+{
+    if (codeBuffer != nullptr)
+        munmap(codeBuffer, codeBufferSize);
+}
+
+uint64_t Chip8Jit::run(uint64_t n)
+{
+    // Instructions that can trap end their block, so one that did was the
+    // last executed.
+    uint64_t executed = 0;
+    while (executed < n && c.trap == Chip8Trap::None) {
+        // The last byte of memory can't hold a whole instruction.
+        if (c.PC >= 4095) {
+            c.step();
+            ++executed;
+            continue;
+        }
+
+        int index = blockAt[c.PC];
+        if (index == NO_BLOCK && entries[c.PC] < COMPILE_THRESHOLD) {
+            ++entries[c.PC];
+            c.step();
+            ++executed;
+            continue;
+        }
+        if (index == NO_BLOCK) {
+            index = compile(c.PC);
+            if (index == NO_BLOCK)
+                return executed;
+        }
+
+        if (index == INTERPRET_ONLY || blocks[index].length > n - executed) {
+            c.step();
+            ++executed;
+            continue;
+        }
+
+        const Block& block = blocks[index];
+
+        // The block may invalidate itself, so don't touch it after the call.
+        executed += block.length;
+        block.code(&c);
+    }
+    return executed;
+}
+
+void Chip8Jit::invalidate(uint16_t address)
+{
+    entries[address] = 0;
+    if (coverage[address] == 0)
+        return;
+
+    // Only a block starting at most MAX_BLOCK_LENGTH instructions back can
+    // reach this far.
+    int first = address - 2 * MAX_BLOCK_LENGTH + 1;
+    if (first < 0)
+        first = 0;
+
+    for (int start = first; start <= address; ++start) {
+        if (blockAt[start] < 0)
+            continue;
+
+        const Block& block = blocks[blockAt[start]];
+        if (address >= block.end)
+            continue;
+
+        for (int i = block.start; i < block.end; ++i)
+            --coverage[i];
+
+        if (++invalidations[start] >= MAX_INVALIDATIONS)
+            blockAt[start] = INTERPRET_ONLY;
+        else
+            blockAt[start] = NO_BLOCK;
+    }
+}
+
+void Chip8Jit::invalidateAll()
+{
+    blocks.clear();
+    codeBufferUsed = 0;
+    for (int& index : blockAt)
+        index = NO_BLOCK;
+    memset(coverage, 0, sizeof(coverage));
+    memset(invalidations, 0, sizeof(invalidations));
+    memset(entries, 0, sizeof(entries));
+}
+
+bool Chip8Jit::reserveCode(size_t size)
+{
+    if (codeBufferUsed + size <= codeBufferSize)
+        return true;
+
+    if (codeBufferSize == MAX_CODE_BUFFER_SIZE) {
+        invalidateAll();
+        return true;
+    }
+
+    // Blocks hold absolute addresses into the old buffer, so growing it
+    // drops them all.
+    const size_t newSize = codeBuffer == nullptr ? INITIAL_CODE_BUFFER_SIZE
+                                                 : 2 * codeBufferSize;
+    void* buffer = mmap(nullptr, newSize, PROT_READ | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        perror("Failed to map JIT code buffer");
+        return false;
+    }
+    if (codeBuffer != nullptr)
+        munmap(codeBuffer, codeBufferSize);
+    codeBuffer = static_cast<uint8_t*>(buffer);
+    codeBufferSize = newSize;
+    invalidateAll();
+    return true;
+}
+
+int Chip8Jit::compile(uint16_t address)
+{
+    if (failed)
+        return NO_BLOCK;
+
+    std::vector<uint8_t> code;
+    X86Emitter emit(code);
+
+    auto V = [this](int r) { return offsetV + r; };
+
+    emit.prologue();
+
+    uint16_t pc = address;
+    uint16_t length = 0;
+    bool terminated = false;
+
+    while (!terminated && length < MAX_BLOCK_LENGTH && pc + 1 < 4096) {
+        const uint16_t opcode = (c.memory[pc] << 8) | c.memory[pc + 1];
+        const uint8_t x = (opcode & 0x0F00) >> 8;
+        const uint8_t y = (opcode & 0x00F0) >> 4;
+        const uint8_t kk = opcode & 0x00FF;
+        const uint16_t nnn = opcode & 0x0FFF;
+
+        bool native = true;
+
+        switch (opcode & 0xF000) {
+        case 0x1000:
+            emit.store16Imm(offsetPC, nnn);
+            break;
+        case 0x6000:
+            emit.store8Imm(V(x), kk);
+            break;
+        case 0x7000:
+            emit.add8Imm(V(x), kk);
+            break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+            case 0x0:
+                emit.load8(AL, V(y));
+                emit.store8(V(x), AL);
+                break;
+            case 0x1:
+            case 0x2:
+            case 0x3: {
+                static const uint8_t aluOps[] = { 0x0A, 0x22, 0x32 };
+                emit.load8(AL, V(x));
+                emit.aluAlMem(aluOps[(opcode & 0x000F) - 1], V(y));
+                emit.store8(V(x), AL);
+                if (quirks.logicResetsVF)
+                    emit.store8Imm(V(0xF), 0);
+                break;
+            }
+            case 0x4:
+                emit.load8(AL, V(x));
+                emit.aluAlMem(0x02, V(y));
+                emit.setcCl();
+                emit.store8(V(x), AL);
+                emit.store8(V(0xF), CL);
+                break;
+            case 0x5:
+            case 0x7: {
+                // 8xy5 computes Vx - Vy, 8xy7 computes Vy - Vx.
+                const bool reversed = (opcode & 0x000F) == 0x7;
+                emit.load8(AL, V(reversed ? y : x));
+                emit.load8(DL, V(reversed ? x : y));
+                emit.cmpAlDl();
+                emit.setaCl();
+                emit.subAlDl();
+                emit.store8(V(x), AL);
+                emit.store8(V(0xF), CL);
+                break;
+            }
+            case 0x6:
+            case 0xE: {
+                // The bit shifted out goes to VF.
+                const uint8_t source = quirks.shiftsVy ? y : x;
+                emit.load8(CL, V(source));
+                emit.load8(AL, V(source));
+                if ((opcode & 0x000F) == 0x6) {
+                    emit.andClImm(1);
+                    emit.shrAl1();
+                } else {
+                    emit.shrClImm(7);
+                    emit.shlAl1();
+                }
+                emit.store8(V(x), AL);
+                emit.store8(V(0xF), CL);
+                break;
+            }
+            default:
+                native = false;
+                break;
+            }
+            break;
+        case 0xA000:
+            emit.store16Imm(offsetI, nnn);
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+            case 0x07:
+                emit.load8(AL, offsetDelayTimer);
+                emit.store8(V(x), AL);
+                break;
+            case 0x15:
+                emit.load8(AL, V(x));
+                emit.store8(offsetDelayTimer, AL);
+                break;
+            case 0x18:
+                emit.load8(AL, V(x));
+                emit.store8(offsetSoundTimer, AL);
+                break;
+            case 0x1E:
+                emit.add16FromByte(offsetI, V(x));
+                break;
+            default:
+                native = false;
+                break;
+            }
+            break;
+        default:
+            native = false;
+            break;
+        }
+
+        if (!native) {
+            emit.store16Imm(offsetPC, pc);
+            emit.callWithMachine(interpret);
+        }
+
+        terminated = endsBlock(opcode);
+        pc += 2;
+        ++length;
+    }
+
+    // Falling off the end of the block: the next instruction is the one after
+    // the last translated. Terminators have already set PC themselves.
+    if (!terminated)
+        emit.store16Imm(offsetPC, pc);
+
+    emit.epilogue();
+
+    if (!reserveCode(code.size())) {
+        failed = true;
+        return NO_BLOCK;
+    }
+
+    // Keep the buffer executable or writable, never both at once, flipping
+    // only the pages the new block lands on. If either flip fails, blocks
+    // already on those pages may no longer be executable, so none are run
+    // again.
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t* firstPage = codeBuffer + codeBufferUsed / pageSize * pageSize;
+    const size_t protectedSize
+        = codeBuffer + codeBufferUsed + code.size() - firstPage;
+    if (mprotect(firstPage, protectedSize, PROT_READ | PROT_WRITE) != 0) {
+        perror("Failed to make JIT code writable");
+        failed = true;
+        invalidateAll();
+        return NO_BLOCK;
+    }
+    memcpy(codeBuffer + codeBufferUsed, code.data(), code.size());
+    if (mprotect(firstPage, protectedSize, PROT_READ | PROT_EXEC) != 0) {
+        perror("Failed to make JIT code executable");
+        failed = true;
+        invalidateAll();
+        return NO_BLOCK;
+    }
+
+    Block block;
+    block.code = reinterpret_cast<BlockFunction>(codeBuffer + codeBufferUsed);
+    block.start = address;
+    block.end = pc;
+    block.length = length;
+
+    codeBufferUsed += code.size();
+
+    for (int i = block.start; i < block.end; ++i)
+        ++coverage[i];
+
+    blocks.push_back(block);
+    blockAt[address] = blocks.size() - 1;
+    return blockAt[address];
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+// Basic-block recompiler from CHIP-8 to x86-64.
+//
+// A block is the straight run of instructions starting at some address, up
+// to and including the first one that can change control flow (a jump, call,
+// return or skip). Arithmetic, register loads and timer accesses are emitted
+// as native code; everything else is emitted as a call back into the switch
+// interpreter for that one instruction. Translated blocks are cached by entry
+// address and dropped when storeMemory() writes to any byte they cover.
+//
+// A machine's quirk profile never changes, so native code follows it by
+// being translated for it, rather than by testing it when the block runs.
+
+#include "chip8_quirks.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Chip8;
+
+class Chip8Jit
+{
+public:
+    explicit Chip8Jit(Chip8& c);
+    ~Chip8Jit();
+
+    Chip8Jit(const Chip8Jit&) = delete;
+    Chip8Jit& operator=(const Chip8Jit&) = delete;
+
+    // Execute n instructions, or up to and including one that traps, and
+    // return how many were executed. Fewer than n without a trap means no
+    // executable memory could be had for the code at PC. Whole blocks run
+    // natively; when fewer instructions remain than the next block holds, or
+    // the code at PC keeps modifying itself, instructions are interpreted
+    // instead.
+    uint64_t run(uint64_t n);
+
+    // Drop every block covering the byte at address.
+    void invalidate(uint16_t address);
+
+    // Drop every block, e.g. after memory was replaced wholesale.
+    void invalidateAll();
+
+private:
+    typedef void (*BlockFunction)(Chip8* c);
+
+    struct Block
+    {
+        BlockFunction code;
+        uint16_t start;
+        // One past the last byte the block was translated from.
+        uint16_t end;
+        uint16_t length;
+    };
+
+    // blockAt entries that don't refer to a block.
+    static constexpr int NO_BLOCK = -1;
+    static constexpr int INTERPRET_ONLY = -2;
+
+    // The code buffer starts small, since most ROMs translate to a few
+    // kilobytes, and doubles each time it fills up, to at most
+    // MAX_CODE_BUFFER_SIZE; past that, filling it drops every block.
+    static constexpr size_t INITIAL_CODE_BUFFER_SIZE = 64 << 10;
+    static constexpr size_t MAX_CODE_BUFFER_SIZE = 4 << 20;
+    static constexpr int MAX_BLOCK_LENGTH = 64;
+    // Blocks that keep getting overwritten aren't worth translating again:
+    // after this many invalidations their address is left to the interpreter.
+    static constexpr int MAX_INVALIDATIONS = 8;
+    // Code is interpreted until execution has entered it this many times,
+    // since memory there last changed: making room for a block costs two
+    // system calls, which code that runs once or twice never earns back.
+    static constexpr int COMPILE_THRESHOLD = 4;
+
+    // Translate the block starting at address and return its index into
+    // blocks, or NO_BLOCK if there's no executable memory to put it in.
+    int compile(uint16_t address);
+    // Make room for size more bytes of code. Returns false if the buffer
+    // can't be mapped.
+    bool reserveCode(size_t size);
+
+    Chip8& c;
+    const Chip8Quirks quirks;
+    // The interpreter's instantiation for the machine's profile, which
+    // untranslated instructions call.
+    void (*interpret)(Chip8* c);
+
+    uint8_t* codeBuffer = nullptr;
+    size_t codeBufferSize = 0;
+    size_t codeBufferUsed = 0;
+    // Set once mapping or protecting the code buffer failed. Nothing is
+    // translated after that and run() leaves the rest to its caller.
+    bool failed = false;
+
+    std::vector<Block> blocks;
+    // Index into blocks of the block starting at each address.
+    int blockAt[4096];
+    // How many live blocks cover each byte of memory.
+    uint16_t coverage[4096];
+    // How many times the block starting at each address was invalidated.
+    uint8_t invalidations[4096];
+    // How many times execution entered each address that has no block yet,
+    // up to COMPILE_THRESHOLD.
+    uint8_t entries[4096];
+
+    // Offsets of the registers from the start of the Chip8 object.
+    int32_t offsetV, offsetI, offsetPC, offsetDelayTimer, offsetSoundTimer;
+};
@@ -0,0 +1,518 @@
+#include "chip8_lockstep.h"
+#include "chip8_ops.h"
+
+#include <algorithm>
+#include <cstring>
+
+// The helpers below pass vectors by value, which GCC warns changes the ABI
+// between AVX and non-AVX builds. They are all internal to this file, and
+// the class interface passes vectors by reference.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// The trap opcode raises in every lane, whatever its state: InvalidOpcode
+// where Chip8 raises it too, and UnsupportedOpcode for the SUPER-CHIP and
+// XO-CHIP instructions.
+static Chip8Trap opcodeTrap(uint16_t opcode)
+{
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if ((opcode & 0xFFF0) == 0x00C0 || (opcode & 0xFFF0) == 0x00D0
+            || (opcode >= 0x00FB && opcode <= 0x00FF))
+            return Chip8Trap::UnsupportedOpcode;
+        return Chip8Trap::None;
+    case 0x5000:
+        if ((opcode & 0x000F) == 0x2 || (opcode & 0x000F) == 0x3)
+            return Chip8Trap::UnsupportedOpcode;
+        return Chip8Trap::None;
+    case 0x8000:
+        if ((opcode & 0x000F) <= 0x7 || (opcode & 0x000F) == 0xE)
+            return Chip8Trap::None;
+        return Chip8Trap::InvalidOpcode;
+    case 0xD000:
+        // Dxy0 draws SUPER-CHIP's 16x16 sprites.
+        if ((opcode & 0x000F) == 0)
+            return Chip8Trap::UnsupportedOpcode;
+        return Chip8Trap::None;
+    case 0xE000:
+        if ((opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1)
+            return Chip8Trap::None;
+        return Chip8Trap::InvalidOpcode;
+    case 0xF000:
+        if (opcode == 0xF000 || opcode == 0xF002)
+            return Chip8Trap::UnsupportedOpcode;
+        switch (opcode & 0x00FF) {
+        case 0x07:
+        case 0x0A:
+        case 0x15:
+        case 0x18:
+        case 0x1E:
+        case 0x29:
+        case 0x33:
+        case 0x55:
+        case 0x65:
+            return Chip8Trap::None;
+        case 0x01:
+        case 0x30:
+        case 0x3A:
+        case 0x75:
+        case 0x85:
+            return Chip8Trap::UnsupportedOpcode;
+        default:
+            return Chip8Trap::InvalidOpcode;
+        }
+    default:
+        return Chip8Trap::None;
+    }
+}
+
+// Select value in the lanes set in mask and keep old elsewhere.
+template <typename Vector>
+static inline Vector blend(Vector old, Vector value, Vector mask)
+{
+    return (old & ~mask) | (value & mask);
+}
+
+template <typename Vector, typename Element>
+static inline Vector splat(Element value)
+{
+    Vector v;
+    for (size_t i = 0; i < sizeof(Vector) / sizeof(v[0]); ++i)
+        v[i] = value;
+    return v;
+}
+
+template <typename Vector>
+static inline bool anyLane(const Vector& v)
+{
+    uint64_t words[sizeof(Vector) / sizeof(uint64_t)];
+    memcpy(words, &v, sizeof(words));
+    uint64_t any = 0;
+    for (uint64_t word : words)
+        any |= word;
+    return any != 0;
+}
+
+template <int Lanes>
+Chip8Lockstep<Lanes>::Chip8Lockstep(const Chip8& prototype)
+    : profile(prototype.profile())
+{
+    for (int i = 0; i < 4096; ++i)
+        memory[i] = splat<LaneBytes>(prototype.memory[i]);
+    for (int i = 0; i < 16; ++i) {
+        V[i] = splat<LaneBytes>(prototype.V[i]);
+        stack[i] = splat<LaneWords>(prototype.stack[i]);
+        keyboard[i]
+            = splat<LaneBytes>(uint8_t(prototype.keyboard[i] ? 0xFF : 0));
+    }
+    I = splat<LaneWords>(prototype.I);
+    delayTimer = splat<LaneBytes>(prototype.delayTimer);
+    soundTimer = splat<LaneBytes>(prototype.soundTimer);
+    PC = splat<LaneWords>(prototype.PC);
+    SP = splat<LaneBytes>(prototype.SP);
+    for (int d = 0; d < 2; ++d) {
+        for (int row = 0; row < 32; ++row) {
+            display[d][row]
+                = splat<LaneRows>(prototype.display[d].bits[0][row][0]);
+        }
+    }
+    for (int lane = 0; lane < Lanes; ++lane) {
+        random[lane] = prototype.random;
+        trap[lane] = prototype.trap;
+    }
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::runCycles(uint64_t n)
+{
+    // Per-lane counts are 16 bits wide, so long runs go in chunks.
+    while (n > 0) {
+        uint16_t chunk = n > 0xFFFF ? 0xFFFF : n;
+        LaneWords remaining = splat<LaneWords>(chunk);
+        for (int lane = 0; lane < Lanes; ++lane) {
+            if (trap[lane] != Chip8Trap::None)
+                remaining[lane] = 0;
+        }
+        visitQuirks(profile, [&]<Chip8Quirks Quirks>() {
+            while (anyLane(remaining))
+                step<Quirks>(remaining);
+        });
+        n -= chunk;
+    }
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::tickTimers()
+{
+    delayTimer -= (LaneBytes)(delayTimer != 0) & 1;
+    soundTimer -= (LaneBytes)(soundTimer != 0) & 1;
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::runFrame(uint64_t instructionsPerFrame)
+{
+    runCycles(instructionsPerFrame);
+
+    LaneBytes running;
+    for (int lane = 0; lane < Lanes; ++lane)
+        running[lane] = trap[lane] == Chip8Trap::None ? 1 : 0;
+    delayTimer -= (LaneBytes)(delayTimer != 0) & running;
+    soundTimer -= (LaneBytes)(soundTimer != 0) & running;
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::setKey(int lane, int key, bool pressed)
+{
+    keyboard[key & 0xF][lane] = pressed ? 0xFF : 0;
+}
+
+template <int Lanes>
+void Chip8Lockstep<Lanes>::copyLaneTo(int lane, Chip8& machine) const
+{
+    for (int i = 0; i < 4096; ++i)
+        machine.storeMemory(i, memory[i][lane]);
+    for (int i = 0; i < 16; ++i) {
+        machine.V[i] = V[i][lane];
+        machine.stack[i] = stack[i][lane];
+        machine.keyboard[i] = keyboard[i][lane] != 0;
+    }
+    machine.I = I[lane];
+    machine.delayTimer = delayTimer[lane];
+    machine.soundTimer = soundTimer[lane];
+    machine.PC = PC[lane];
+    machine.SP = SP[lane];
+    memset(machine.display, 0, sizeof(machine.display));
+    for (int d = 0; d < 2; ++d) {
+        for (int row = 0; row < 32; ++row)
+            machine.display[d].bits[0][row][0] = display[d][row][lane];
+    }
+    machine.markRowsChanged(~0ull);
+    machine.random = random[lane];
+    machine.trap = trap[lane];
+}
+
+template <int Lanes>
+template <Chip8Quirks Quirks>
+void Chip8Lockstep<Lanes>::step(LaneWords& remaining)
+{
+    const LaneWords active = (LaneWords)(remaining != 0);
+
+    // Lanes at the lowest PC go first, so that lanes which fell behind on a
+    // skipped or divergent branch catch up with the rest instead of running
+    // ahead. Finished lanes are pushed out of the way to PC 0xFFFF.
+    const LaneWords candidates = PC | ~active;
+    uint16_t pc = 0xFFFF;
+    for (int lane = 0; lane < Lanes; ++lane)
+        pc = std::min<uint16_t>(pc, candidates[lane]);
+    int leader = 0;
+    while (candidates[leader] != pc || !active[leader])
+        ++leader;
+
+    const uint8_t high = memory[pc & 0xFFF][leader];
+    const uint8_t low = memory[(pc + 1) & 0xFFF][leader];
+    const uint16_t opcode = (high << 8) | low;
+
+    // Lanes that run this step: active, at the same PC, and with the same
+    // opcode there (self-modifying code may have changed it in some lanes).
+    const LaneByteMask sameOpcode = (memory[pc & 0xFFF] == high)
+        & (memory[(pc + 1) & 0xFFF] == low);
+    LaneWords m = active & (LaneWords)(PC == pc)
+        & (LaneWords) __builtin_convertvector(sameOpcode, LaneWordMask);
+
+    const Chip8Instruction in = decodeOperands(opcode);
+
+    // Lanes the instruction faults in stop on it, with no cycles left, and
+    // the rest run it without them. Whether the stack or memory past 0xFFF
+    // is in reach depends on the lane.
+    auto retire = [&](int lane, Chip8Trap reason) {
+        trap[lane] = reason;
+        remaining[lane] = 0;
+        m[lane] = 0;
+    };
+    const Chip8Trap fault
+        = pc > 0xFFE ? Chip8Trap::UnsupportedOpcode : opcodeTrap(opcode);
+    if (fault != Chip8Trap::None) {
+        for (int lane = 0; lane < Lanes; ++lane) {
+            if (m[lane])
+                retire(lane, fault);
+        }
+        return;
+    }
+    // How many bytes from I the instruction reads or writes.
+    int span = 0;
+    if ((opcode & 0xF000) == 0xD000)
+        span = in.n;
+    else if ((opcode & 0xF0FF) == 0xF033)
+        span = 3;
+    else if ((opcode & 0xF0FF) == 0xF055 || (opcode & 0xF0FF) == 0xF065)
+        span = in.x + 1;
+    if (span != 0 || opcode == 0x00EE || (opcode & 0xF000) == 0x2000) {
+        for (int lane = 0; lane < Lanes; ++lane) {
+            if (!m[lane])
+                continue;
+            if (opcode == 0x00EE && SP[lane] == 0)
+                retire(lane, Chip8Trap::StackUnderflow);
+            else if ((opcode & 0xF000) == 0x2000 && SP[lane] == 15)
+                retire(lane, Chip8Trap::StackOverflow);
+            else if (I[lane] + span > 0x1000)
+                retire(lane, Chip8Trap::UnsupportedOpcode);
+        }
+    }
+
+    const LaneBytes mb = __builtin_convertvector(m, LaneBytes);
+    const LaneWords next = m & splat<LaneWords>(uint16_t(2));
+    remaining -= m & 1;
+
+    auto skipIf = [&](const LaneByteMask& condition) {
+        const LaneWords skip
+            = (LaneWords) __builtin_convertvector(condition, LaneWordMask);
+        // A taken skip steps over XO-CHIP's four-byte F000 nnnn whole, as
+        // skipLength() in chip8_ops.h does.
+        const LaneWords longSkip = (LaneWords) __builtin_convertvector(
+            (memory[(pc + 2) & 0xFFF] == 0xF0)
+                & (memory[(pc + 3) & 0xFFF] == 0x00),
+            LaneWordMask);
+        PC += next + (next & skip) + (next & skip & longSkip);
+    };
+    // Where Fx55 and Fx65 leave I, as in advanceIndex() in chip8_ops.h.
+    auto advanceIndex = [&] {
+        if constexpr (Quirks.loadStoreIndex == Chip8IndexQuirk::AddXPlusOne)
+            I += m & splat<LaneWords>(uint16_t(in.x + 1));
+        else if constexpr (Quirks.loadStoreIndex == Chip8IndexQuirk::AddX)
+            I += m & splat<LaneWords>(uint16_t(in.x));
+    };
+    auto forEachLane = [&](auto&& body) {
+        for (int lane = 0; lane < Lanes; ++lane) {
+            if (m[lane])
+                body(lane);
+        }
+    };
+
+    LaneBytes& Vx = V[in.x];
+    const LaneBytes Vy = V[in.y];
+
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00EE) {
+            forEachLane([&](int lane) {
+                PC[lane] = stack[SP[lane]][lane];
+                --SP[lane];
+            });
+        } else {
+            if (opcode == 0x00E0) {
+                const LaneRows mr = (LaneRows) __builtin_convertvector(
+                    (LaneWordMask)m, LaneRowMask);
+                for (int row = 0; row < 32; ++row) {
+                    display[0][row]
+                        = blend(display[0][row], display[1][row], mr);
+                    display[1][row] &= ~mr;
+                }
+            }
+            PC += next;
+        }
+        break;
+    case 0x1000:
+        PC = blend(PC, splat<LaneWords>(in.nnn), m);
+        break;
+    case 0x2000:
+        forEachLane([&](int lane) {
+            ++SP[lane];
+            stack[SP[lane]][lane] = PC[lane] + 2;
+            PC[lane] = in.nnn;
+        });
+        break;
+    case 0x3000:
+        skipIf(Vx == in.kk);
+        break;
+    case 0x4000:
+        skipIf(Vx != in.kk);
+        break;
+    case 0x5000:
+        skipIf(Vx == Vy);
+        break;
+    case 0x6000:
+        Vx = blend(Vx, splat<LaneBytes>(in.kk), mb);
+        PC += next;
+        break;
+    case 0x7000:
+        Vx += mb & in.kk;
+        PC += next;
+        break;
+    case 0x8000: {
+        // Compute both results from the old registers before writing either,
+        // since x or y may be F.
+        LaneBytes result = Vx;
+        LaneBytes flag = V[0xF];
+        // For the instructions that leave VF alone, unless it's Vx.
+        auto unchangedFlag = [&] { return in.x == 0xF ? result : V[0xF]; };
+        auto logicFlag = [&] {
+            return Quirks.logicResetsVF ? splat<LaneBytes>(uint8_t(0))
+                                        : unchangedFlag();
+        };
+        const LaneBytes shifted = Quirks.shiftsVy ? Vy : Vx;
+        switch (in.n) {
+        case 0x0:
+            result = Vy;
+            flag = unchangedFlag();
+            break;
+        case 0x1:
+            result = Vx | Vy;
+            flag = logicFlag();
+            break;
+        case 0x2:
+            result = Vx & Vy;
+            flag = logicFlag();
+            break;
+        case 0x3:
+            result = Vx ^ Vy;
+            flag = logicFlag();
+            break;
+        case 0x4:
+            result = Vx + Vy;
+            flag = (LaneBytes)(result < Vx) & 1;
+            break;
+        case 0x5:
+            result = Vx - Vy;
+            flag = (LaneBytes)(Vx > Vy) & 1;
+            break;
+        case 0x6:
+            result = shifted >> 1;
+            flag = shifted & 1;
+            break;
+        case 0x7:
+            result = Vy - Vx;
+            flag = (LaneBytes)(Vy > Vx) & 1;
+            break;
+        case 0xE:
+            result = shifted << 1;
+            flag = shifted >> 7;
+            break;
+        }
+        Vx = blend(Vx, result, mb);
+        V[0xF] = blend(V[0xF], flag, mb);
+        PC += next;
+        break;
+    }
+    case 0x9000:
+        skipIf(Vx != Vy);
+        break;
+    case 0xA000:
+        I = blend(I, splat<LaneWords>(in.nnn), m);
+        PC += next;
+        break;
+    case 0xB000:
+        PC = blend(PC,
+            in.nnn
+                + __builtin_convertvector(
+                    V[Quirks.jumpsWithVx ? in.x : 0], LaneWords),
+            m);
+        break;
+    case 0xC000:
+        forEachLane([&](int lane) {
+            Vx[lane] = random[lane].nextByte() & in.kk;
+        });
+        PC += next;
+        break;
+    case 0xD000: {
+        const LaneRows mr = (LaneRows) __builtin_convertvector(
+            (LaneWordMask)m, LaneRowMask);
+        for (int row = 0; row < 32; ++row)
+            display[0][row] = blend(display[0][row], display[1][row], mr);
+
+        forEachLane([&](int lane) {
+            const int X = V[in.x][lane] % 64;
+            const int Y = V[in.y][lane] % 32;
+            uint64_t overlap = 0;
+            for (int i = 0; i < in.n; ++i) {
+                if (!Quirks.wrapsSprites && Y + i >= 32)
+                    break;
+                const uint8_t spriteRow = memory[(I[lane] + i) & 0xFFF][lane];
+                const uint64_t sprite = (uint64_t)spriteRow << 56;
+                // Pixels past the right edge wrap or are clipped, as in
+                // placeSpriteRow().
+                uint64_t placed = sprite >> X;
+                if constexpr (Quirks.wrapsSprites)
+                    placed |= (sprite << 1) << (63 - X);
+                const int row = (Y + i) % 32;
+                overlap |= placed & display[1][row][lane];
+                display[1][row][lane] ^= placed;
+            }
+            V[0xF][lane] = overlap != 0;
+        });
+        PC += next;
+        break;
+    }
+    case 0xE000: {
+        LaneBytes pressed = splat<LaneBytes>(uint8_t(0));
+        forEachLane([&](int lane) {
+            pressed[lane] = keyboard[Vx[lane] & 0xF][lane];
+        });
+        skipIf((LaneByteMask)(in.kk == 0x9E ? pressed : ~pressed));
+        break;
+    }
+    case 0xF000:
+        switch (in.kk) {
+        case 0x07:
+            Vx = blend(Vx, delayTimer, mb);
+            PC += next;
+            break;
+        case 0x0A:
+            forEachLane([&](int lane) {
+                for (int key = 0; key < 16; ++key) {
+                    if (keyboard[key][lane]) {
+                        Vx[lane] = key;
+                        PC[lane] += 2;
+                        break;
+                    }
+                }
+            });
+            break;
+        case 0x15:
+            delayTimer = blend(delayTimer, Vx, mb);
+            PC += next;
+            break;
+        case 0x18:
+            soundTimer = blend(soundTimer, Vx, mb);
+            PC += next;
+            break;
+        case 0x1E:
+            I += m & __builtin_convertvector(Vx, LaneWords);
+            PC += next;
+            break;
+        case 0x29:
+            I = blend(I, (__builtin_convertvector(Vx, LaneWords) & 0xF) * 5,
+                m);
+            PC += next;
+            break;
+        case 0x33:
+            forEachLane([&](int lane) {
+                const uint8_t value = Vx[lane];
+                memory[I[lane] & 0xFFF][lane] = value / 100;
+                memory[(I[lane] + 1) & 0xFFF][lane] = value / 10 % 10;
+                memory[(I[lane] + 2) & 0xFFF][lane] = value % 10;
+            });
+            PC += next;
+            break;
+        case 0x55:
+            forEachLane([&](int lane) {
+                for (int i = 0; i <= in.x; ++i)
+                    memory[(I[lane] + i) & 0xFFF][lane] = V[i][lane];
+            });
+            advanceIndex();
+            PC += next;
+            break;
+        case 0x65:
+            forEachLane([&](int lane) {
+                for (int i = 0; i <= in.x; ++i)
+                    V[i][lane] = memory[(I[lane] + i) & 0xFFF][lane];
+            });
+            advanceIndex();
+            PC += next;
+            break;
+        }
+        break;
+    }
+}
+
+template class Chip8Lockstep<8>;
+template class Chip8Lockstep<16>;
+template class Chip8Lockstep<32>;
@@ -0,0 +1,121 @@
+#pragma once
+
+// Many machines running the same ROM in lockstep, stored as structure of
+// arrays.
+//
+// Every register holds one value per lane in a GCC/Clang vector, so an
+// instruction that all lanes execute together is a handful of vector
+// operations (SSE2 or AVX2, depending on the target) instead of one scalar
+// step per machine. Lanes may diverge: each step executes the instruction at
+// the lowest PC among the lanes that still have cycles to run, for exactly
+// the lanes at that PC with the same opcode there, while the others are
+// masked off and wait to regroup.
+//
+// Instructions whose operands differ per lane in ways vectors can't express
+// (sprite draws, memory stores and loads, the stack, randomness, keypad
+// reads) fall back to a loop over the active lanes.
+//
+// Only the original CHIP-8 machine is modelled: 4 KiB of memory and the 64x32
+// display in one plane. The SUPER-CHIP and XO-CHIP instructions, and code or
+// data past 0xFFF, stop a lane with Chip8Trap::UnsupportedOpcode, and
+// prototypes are expected to be in the low-resolution mode. Lanes run with
+// the prototype's quirk profile, with step() instantiated for each.
+//
+// A lane that faults stops on the faulting instruction with its trap in
+// trap[], as a Chip8 would, and the other lanes carry on without it.
+
+#include "chip8.h"
+
+#include <cstdint>
+
+// Vector types for each supported lane count. GCC ignores vector_size on a
+// typedef whose size depends on a template parameter, so every width is
+// spelled out.
+template <int Lanes>
+struct Chip8LaneTypes;
+
+#define CHIP8_LANE_TYPES(lanes)                                              \
+    template <>                                                              \
+    struct Chip8LaneTypes<lanes>                                             \
+    {                                                                        \
+        typedef uint8_t Bytes __attribute__((vector_size(lanes)));           \
+        typedef uint16_t Words __attribute__((vector_size(lanes * 2)));      \
+        typedef uint64_t Rows __attribute__((vector_size(lanes * 8)));       \
+        typedef int8_t ByteMask __attribute__((vector_size(lanes)));         \
+        typedef int16_t WordMask __attribute__((vector_size(lanes * 2)));    \
+        typedef int64_t RowMask __attribute__((vector_size(lanes * 8)));     \
+    };
+
+CHIP8_LANE_TYPES(8)
+CHIP8_LANE_TYPES(16)
+CHIP8_LANE_TYPES(32)
+
+#undef CHIP8_LANE_TYPES
+
+template <int Lanes>
+class Chip8Lockstep
+{
+    static_assert(Lanes == 8 || Lanes == 16 || Lanes == 32,
+        "Chip8Lockstep supports 8, 16 or 32 lanes");
+
+public:
+    typedef typename Chip8LaneTypes<Lanes>::Bytes LaneBytes;
+    typedef typename Chip8LaneTypes<Lanes>::Words LaneWords;
+    typedef typename Chip8LaneTypes<Lanes>::Rows LaneRows;
+
+    // Lane masks are all-ones in selected lanes and zero elsewhere. The
+    // signed types are what vector comparisons produce, and sign-extend when
+    // a mask is widened.
+    typedef typename Chip8LaneTypes<Lanes>::ByteMask LaneByteMask;
+    typedef typename Chip8LaneTypes<Lanes>::WordMask LaneWordMask;
+    typedef typename Chip8LaneTypes<Lanes>::RowMask LaneRowMask;
+
+    // Every lane starts out as a copy of prototype.
+    explicit Chip8Lockstep(const Chip8& prototype);
+
+    // Execute n instructions on every lane that hasn't trapped, or on each
+    // up to and including one that traps.
+    void runCycles(uint64_t n);
+
+    // Advance every lane's timers by one 60Hz tick.
+    void tickTimers();
+
+    // Execute one frame's worth of instructions, then tick the timers of the
+    // lanes that didn't trap.
+    void runFrame(
+        uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME);
+
+    void setKey(int lane, int key, bool pressed);
+
+    // Copy one lane's machine state into a scalar machine.
+    void copyLaneTo(int lane, Chip8& machine) const;
+
+    // The same registers as Chip8, one element per lane.
+    LaneBytes memory[4096];
+    LaneBytes V[16];
+    LaneWords I;
+    LaneBytes delayTimer;
+    LaneBytes soundTimer;
+    LaneWords PC;
+    LaneBytes SP;
+    LaneWords stack[16];
+    // 0xFF while pressed, 0 otherwise.
+    LaneBytes keyboard[16];
+    LaneRows display[2][32];
+    Chip8Random random[Lanes];
+    Chip8Trap trap[Lanes];
+
+private:
+    // Execute the instruction of the leading group among the lanes with
+    // cycles remaining, and count it against those lanes. A lane it traps in
+    // has its remaining cycles dropped. Vectors are passed by reference so
+    // the ABI doesn't depend on the target's vector width.
+    template <Chip8Quirks Quirks>
+    void step(LaneWords& remaining);
+
+    Chip8Profile profile;
+};
+
+extern template class Chip8Lockstep<8>;
+extern template class Chip8Lockstep<16>;
+extern template class Chip8Lockstep<32>;
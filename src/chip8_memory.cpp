@@ -0,0 +1,92 @@
+#include "chip8_memory.h"
+
+#include <cstring>
+
+Chip8Memory::Page Chip8Memory::zeroPage = { { 2 }, 0, {} };
+
+void Chip8Memory::retain(Page* page)
+{
+    if (page != &zeroPage)
+        page->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Chip8Memory::release(Page* page)
+{
+    if (page != &zeroPage
+        && page->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete page;
+}
+
+void Chip8Memory::unshare(Page*& page)
+{
+    Page* copy = new Page;
+    copy->references.store(1, std::memory_order_relaxed);
+    copy->hash = page->hash;
+    memcpy(copy->bytes, page->bytes, PAGE_SIZE);
+    release(page);
+    page = copy;
+}
+
+Chip8Memory::Chip8Memory()
+{
+    for (Page*& page : pages)
+        page = &zeroPage;
+}
+
+Chip8Memory::Chip8Memory(const uint8_t* image)
+{
+    for (int i = 0; i < PAGES; ++i) {
+        const uint8_t* bytes = image + i * PAGE_SIZE;
+        if (memcmp(bytes, zeroPage.bytes, PAGE_SIZE) == 0) {
+            pages[i] = &zeroPage;
+            continue;
+        }
+
+        pages[i] = new Page;
+        pages[i]->references.store(1, std::memory_order_relaxed);
+        memcpy(pages[i]->bytes, bytes, PAGE_SIZE);
+        pages[i]->hash = 0;
+        for (int j = 0; j < PAGE_SIZE; ++j)
+            pages[i]->hash ^= hashByte(i * PAGE_SIZE + j, bytes[j]);
+        contentsHash ^= pages[i]->hash;
+    }
+}
+
+Chip8Memory::Chip8Memory(const Chip8Memory& other)
+    : contentsHash(other.contentsHash)
+{
+    for (int i = 0; i < PAGES; ++i) {
+        pages[i] = other.pages[i];
+        retain(pages[i]);
+    }
+}
+
+Chip8Memory& Chip8Memory::operator=(const Chip8Memory& other)
+{
+    // Retain first, in case other shares pages with this.
+    for (int i = 0; i < PAGES; ++i) {
+        retain(other.pages[i]);
+        release(pages[i]);
+        pages[i] = other.pages[i];
+    }
+    contentsHash = other.contentsHash;
+    return *this;
+}
+
+Chip8Memory::~Chip8Memory()
+{
+    for (Page* page : pages)
+        release(page);
+}
+
+bool Chip8Memory::operator==(const Chip8Memory& other) const
+{
+    if (contentsHash != other.contentsHash)
+        return false;
+    for (int i = 0; i < PAGES; ++i) {
+        if (pages[i] != other.pages[i]
+            && memcmp(pages[i]->bytes, other.pages[i]->bytes, PAGE_SIZE) != 0)
+            return false;
+    }
+    return true;
+}
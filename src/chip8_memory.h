@@ -0,0 +1,118 @@
+#pragma once
+
+#include "chip8_hash.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A machine's 64 KiB of memory, as 256 reference-counted 256-byte pages.
+//
+// Copying a Chip8Memory shares every page instead of copying it; a page is
+// only duplicated when one of its sharers writes to it. That makes forking a
+// machine (Chip8::fork()) cost a few pointer copies rather than 64 KiB, and
+// lets thousands of forks of one state share all the memory they never
+// write. Reference counts are atomic, so forks can run on different threads.
+//
+// Pages that are all zeroes, which is most of them for anything but an
+// XO-CHIP program, point at one static page that isn't reference counted at
+// all, so copying them is just the pointer.
+//
+// Reads index like a plain array, with addresses wrapping at 64 KiB. Writes
+// must go through store().
+//
+// A hash of the contents is kept up to date by every write, so hash() is
+// free however much memory there is. Each byte contributes a mix of its
+// address and value, zero bytes nothing, and every page keeps the XOR of its
+// bytes' contributions, so sharing and unsharing pages moves their hashes
+// along with them.
+class Chip8Memory
+{
+public:
+    static constexpr int SIZE = 65536;
+    static constexpr int PAGE_SIZE = 256;
+    static constexpr int PAGES = SIZE / PAGE_SIZE;
+
+    // All zeroes.
+    Chip8Memory();
+    // The SIZE bytes at image.
+    explicit Chip8Memory(const uint8_t* image);
+
+    Chip8Memory(const Chip8Memory& other);
+    Chip8Memory& operator=(const Chip8Memory& other);
+    ~Chip8Memory();
+
+    uint8_t operator[](size_t address) const
+    {
+        return pages[(address >> 8) % PAGES]->bytes[address % PAGE_SIZE];
+    }
+
+    void store(uint16_t address, uint8_t value)
+    {
+        Page*& page = pages[(address >> 8) % PAGES];
+        if (page->references.load(std::memory_order_acquire) != 1)
+            unshare(page);
+        uint8_t& byte = page->bytes[address % PAGE_SIZE];
+        const uint64_t change
+            = hashByte(address, byte) ^ hashByte(address, value);
+        page->hash ^= change;
+        contentsHash ^= change;
+        byte = value;
+    }
+
+    // A hash of the whole contents. Equal contents have equal hashes.
+    uint64_t hash() const { return contentsHash; }
+
+    // Whether other holds the same bytes.
+    bool operator==(const Chip8Memory& other) const;
+
+    // The PAGE_SIZE bytes of page index, for reading.
+    const uint8_t* page(int index) const { return pages[index]->bytes; }
+
+    // Make page index other's page again, sharing it, unless it already is.
+    // Returns whether it was replaced.
+    bool sharePage(const Chip8Memory& other, int index)
+    {
+        if (pages[index] == other.pages[index])
+            return false;
+        contentsHash ^= pages[index]->hash ^ other.pages[index]->hash;
+        retain(other.pages[index]);
+        release(pages[index]);
+        pages[index] = other.pages[index];
+        return true;
+    }
+
+    // Whether page index is still shared with another copy.
+    bool isShared(int index) const
+    {
+        return pages[index]->references.load(std::memory_order_acquire) != 1;
+    }
+
+private:
+    struct Page
+    {
+        std::atomic<uint32_t> references;
+        // The XOR of hashByte() over the page's bytes.
+        uint64_t hash;
+        uint8_t bytes[PAGE_SIZE];
+    };
+
+    static uint64_t hashByte(uint16_t address, uint8_t value)
+    {
+        return value == 0 ? 0 : mixHash((uint64_t)address << 8 | value);
+    }
+
+    // Holds a reference count that never reaches 1, so store() always
+    // unshares it, and retain() and release() leave it alone.
+    static Page zeroPage;
+
+    static void retain(Page* page);
+    static void release(Page* page);
+
+    // Replace page with a private copy of it.
+    static void unshare(Page*& page);
+
+    Page* pages[PAGES];
+    // The XOR of every page's hash.
+    uint64_t contentsHash = 0;
+};
@@ -0,0 +1,135 @@
+#include "chip8_movie.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static constexpr char MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+static constexpr uint8_t MOVIE_VERSION = 2;
+
+static void writeVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(value | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+// Returns false if the input ends mid-varint or the varint is too long.
+static bool readVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && p != end; shift += 7) {
+        const uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+Chip8Movie::Chip8Movie(uint64_t seed, Chip8Profile profile)
+    : seed(seed)
+    , profile(profile)
+{
+}
+
+void Chip8Movie::recordTick(const Chip8& machine)
+{
+    events.push_back({ machine.cycleCount, Chip8MovieEvent::Tick, 0 });
+}
+
+void Chip8Movie::recordKeys(const Chip8& machine, uint16_t keys)
+{
+    events.push_back({ machine.cycleCount, Chip8MovieEvent::Keys, keys });
+}
+
+bool Chip8Movie::save(const std::string& path) const
+{
+    std::vector<uint8_t> data(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+    data.push_back(MOVIE_VERSION);
+    for (int i = 0; i < 8; ++i)
+        data.push_back(seed >> (8 * i));
+    data.push_back((uint8_t)profile);
+
+    uint64_t previous = 0;
+    for (const Chip8MovieEvent& event : events) {
+        const uint64_t delta = event.cycle - previous;
+        writeVarint(data, delta * 2 + (event.kind == Chip8MovieEvent::Keys));
+        if (event.kind == Chip8MovieEvent::Keys)
+            writeVarint(data, event.keys);
+        previous = event.cycle;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return (bool)file;
+}
+
+bool Chip8Movie::load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+
+    const size_t headerSize = sizeof(MOVIE_MAGIC) + 1 + 8 + 1;
+    if (data.size() < headerSize
+        || memcmp(data.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0
+        || data[sizeof(MOVIE_MAGIC)] != MOVIE_VERSION)
+        return false;
+
+    uint64_t newSeed = 0;
+    for (int i = 0; i < 8; ++i)
+        newSeed |= (uint64_t)data[sizeof(MOVIE_MAGIC) + 1 + i] << (8 * i);
+
+    const uint8_t newProfile = data[headerSize - 1];
+    if (newProfile >= availableProfiles().size())
+        return false;
+
+    std::vector<Chip8MovieEvent> newEvents;
+    const uint8_t* p = data.data() + headerSize;
+    const uint8_t* end = data.data() + data.size();
+    uint64_t cycle = 0;
+    while (p != end) {
+        uint64_t code;
+        if (!readVarint(p, end, code))
+            return false;
+
+        cycle += code >> 1;
+        Chip8MovieEvent event = { cycle, Chip8MovieEvent::Tick, 0 };
+        if (code & 1) {
+            uint64_t keys;
+            if (!readVarint(p, end, keys) || keys > 0xFFFF)
+                return false;
+            event.kind = Chip8MovieEvent::Keys;
+            event.keys = keys;
+        }
+        newEvents.push_back(event);
+    }
+
+    seed = newSeed;
+    profile = (Chip8Profile)newProfile;
+    events = std::move(newEvents);
+    return true;
+}
+
+void Chip8Movie::play(Chip8& machine, Chip8FrameWriter* frames) const
+{
+    for (const Chip8MovieEvent& event : events) {
+        if (machine.runCycles(event.cycle - machine.cycleCount)
+            != Chip8Trap::None)
+            return;
+
+        if (event.kind == Chip8MovieEvent::Tick) {
+            machine.tickTimers();
+            if (frames != nullptr)
+                frames->write(machine);
+        } else {
+            for (int i = 0; i < 16; ++i)
+                machine.keyboard[i] = (event.keys >> i) & 1;
+        }
+    }
+}
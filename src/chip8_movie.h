@@ -0,0 +1,65 @@
+#pragma once
+
+// Input movies: everything from outside that affects a run, so it can be
+// replayed bit for bit without a window or a human.
+//
+// Given the ROM, the random seed and the quirk profile, a machine's behaviour
+// is decided by just two more things: when the keypad state changes, and when
+// the timers tick (the frontend ticks them on wall-clock time). A movie logs
+// both, keyed by Chip8::cycleCount at the moment they happened.
+//
+// The file format is "C8MV", a version byte, the seed as 8 little-endian
+// bytes and the profile as one, followed by one varint per event: the cycles
+// since the previous event times two, plus one for a keypad change, which is
+// followed by the new key bitmask as another varint. A 60Hz tick costs one or
+// two bytes.
+
+#include "chip8.h"
+#include "chip8_frames.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Chip8MovieEvent
+{
+    enum Kind : uint8_t
+    {
+        Tick,
+        Keys,
+    };
+
+    uint64_t cycle;
+    Kind kind;
+    // For Keys, bit n is set while key n is held down.
+    uint16_t keys;
+};
+
+class Chip8Movie
+{
+public:
+    explicit Chip8Movie(uint64_t seed = DEFAULT_RANDOM_SEED,
+        Chip8Profile profile = DEFAULT_PROFILE);
+
+    // Recording: log an event at machine's current cycle count.
+    void recordTick(const Chip8& machine);
+    void recordKeys(const Chip8& machine, uint16_t keys);
+
+    bool save(const std::string& path) const;
+    // Replace this movie with the one at path. Returns false, leaving it
+    // unchanged, if the file can't be read or isn't a valid movie.
+    bool load(const std::string& path);
+
+    // Replay every event on machine, which must be freshly constructed with
+    // the movie's seed and profile, executing the instructions in between.
+    // If frames is given, the display is written to it at every tick.
+    // Playback stops early if the machine traps.
+    void play(Chip8& machine, Chip8FrameWriter* frames = nullptr) const;
+
+    // The cycle count of the last event.
+    uint64_t length() const { return events.empty() ? 0 : events.back().cycle; }
+
+    uint64_t seed;
+    Chip8Profile profile;
+    std::vector<Chip8MovieEvent> events;
+};
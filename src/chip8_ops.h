@@ -0,0 +1,924 @@
+#pragma once
+
+// Instruction semantics shared by every interpreter engine.
+//
+// Each handler executes one already-decoded instruction against a machine and
+// advances PC, or sets the machine's trap and leaves PC alone if the
+// instruction faults (see Chip8Trap). The switch engine calls them directly
+// so they inline into its dispatch; the predecoded engine stores pointers to
+// them in its cache. Handlers for instructions with quirks are templates over
+// the machine's Chip8Quirks (see chip8_quirks.h).
+
+#include "chip8.h"
+
+#include <cstring>
+
+// An instruction with all of its operand fields pulled out of the opcode.
+struct Chip8Instruction
+{
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+    uint8_t n;
+};
+
+typedef void (*Chip8Handler)(Chip8& c, const Chip8Instruction& in);
+
+// An entry in the predecoded instruction cache: the handler for the
+// instruction at that address, plus its operands.
+struct Chip8DecodedInstruction
+{
+    Chip8Handler handler;
+    Chip8Instruction instruction;
+};
+
+// An entry in the threaded engine's cache. Instead of a handler pointer it
+// holds the address of the handler's label inside Chip8::runThreaded().
+struct Chip8ThreadedInstruction
+{
+    const void* label;
+    Chip8Instruction instruction;
+};
+
+inline Chip8Instruction decodeOperands(uint16_t opcode)
+{
+    Chip8Instruction in;
+    in.opcode = opcode;
+    in.nnn = opcode & 0x0FFF;
+    in.x = (opcode & 0x0F00) >> 8;
+    in.y = (opcode & 0x00F0) >> 4;
+    in.kk = opcode & 0x00FF;
+    in.n = opcode & 0x000F;
+    return in;
+}
+
+inline int displayWidth(const Chip8& c) { return c.hires ? 128 : 64; }
+inline int displayHeight(const Chip8& c) { return c.hires ? 64 : 32; }
+
+// Keep the current frame as the previous one before changing it. Frontends
+// present the two ORed together, which hides sprite flicker, so a row changes
+// on screen when either frame's copy of it does.
+//
+// Only the selected planes can have changed since the last save (opPLANE
+// saves before switching), and only the words in use at this resolution.
+inline void saveDisplayFrame(Chip8& c)
+{
+    const int height = displayHeight(c);
+    const int words = c.hires ? 2 : 1;
+    // Accumulated locally: the display is words of the same type, so the
+    // compiler would otherwise have to store it on every iteration.
+    uint64_t dirtyRows = 0;
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        if (!(c.planeMask & (1 << plane)))
+            continue;
+
+        for (int row = 0; row < height; ++row) {
+            for (int word = 0; word < words; ++word) {
+                uint64_t& previous = c.display[0].bits[plane][row][word];
+                const uint64_t current = c.display[1].bits[plane][row][word];
+                dirtyRows |= (uint64_t)(previous != current) << row;
+                previous = current;
+            }
+        }
+    }
+    c.markRowsChanged(dirtyRows);
+}
+
+// Move the selected planes' rows down by distance, or up if it's negative,
+// filling in blank rows.
+inline void scrollRows(Chip8& c, int distance)
+{
+    saveDisplayFrame(c);
+
+    const int height = displayHeight(c);
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        if (!(c.planeMask & (1 << plane)))
+            continue;
+
+        uint64_t(*rows)[2] = c.display[1].bits[plane];
+        for (int i = 0; i < height; ++i) {
+            // Walk against the direction of the scroll, so that every row is
+            // read before it is overwritten.
+            const int row = distance > 0 ? height - 1 - i : i;
+            const int from = row - distance;
+            uint64_t left = 0;
+            uint64_t right = 0;
+            if (from >= 0 && from < height) {
+                left = rows[from][0];
+                right = rows[from][1];
+            }
+            if (rows[row][0] != left || rows[row][1] != right)
+                c.markRowsChanged(1ull << row);
+            rows[row][0] = left;
+            rows[row][1] = right;
+        }
+    }
+}
+
+// Move the selected planes' pixels right by distance, or left if it's
+// negative, shifting across each row's pair of words.
+inline void scrollColumns(Chip8& c, int distance)
+{
+    saveDisplayFrame(c);
+
+    const int height = displayHeight(c);
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        if (!(c.planeMask & (1 << plane)))
+            continue;
+
+        for (int row = 0; row < height; ++row) {
+            uint64_t* bits = c.display[1].bits[plane][row];
+            uint64_t left = bits[0];
+            uint64_t right = bits[1];
+            if (distance > 0) {
+                right = (right >> distance) | (left << (64 - distance));
+                left >>= distance;
+            } else {
+                left = (left << -distance) | (right >> (64 + distance));
+                right <<= -distance;
+            }
+            // The low-resolution display is only the first word wide.
+            if (!c.hires)
+                right = 0;
+
+            if (bits[0] != left || bits[1] != right)
+                c.markRowsChanged(1ull << row);
+            bits[0] = left;
+            bits[1] = right;
+        }
+    }
+}
+
+// How far a taken skip moves PC: past the next instruction, which is four
+// bytes long if it is XO-CHIP's F000 nnnn.
+inline int skipLength(const Chip8& c)
+{
+    return c.memory[c.PC + 2] == 0xF0 && c.memory[c.PC + 3] == 0x00 ? 6 : 4;
+}
+
+// 0nnn - SYS addr
+// Jump to a machine code routine at nnn. Ignored by modern interpreters.
+inline void opSYS(Chip8& c, const Chip8Instruction&) { c.PC += 2; }
+
+// 00E0 - CLS
+// Clear the display (on XO-CHIP, just the selected planes).
+inline void opCLS(Chip8& c, const Chip8Instruction&)
+{
+    saveDisplayFrame(c);
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        if (!(c.planeMask & (1 << plane)))
+            continue;
+
+        for (int row = 0; row < displayHeight(c); ++row) {
+            uint64_t* bits = c.display[1].bits[plane][row];
+            if ((bits[0] | bits[1]) != 0)
+                c.markRowsChanged(1ull << row);
+            bits[0] = 0;
+            bits[1] = 0;
+        }
+    }
+
+    c.PC += 2;
+}
+
+// 00Cn - SCD nibble (SUPER-CHIP)
+// Scroll the display down n rows.
+inline void opSCD(Chip8& c, const Chip8Instruction& in)
+{
+    scrollRows(c, in.n);
+    c.PC += 2;
+}
+
+// 00Dn - SCU nibble (XO-CHIP)
+// Scroll the display up n rows.
+inline void opSCU(Chip8& c, const Chip8Instruction& in)
+{
+    scrollRows(c, -in.n);
+    c.PC += 2;
+}
+
+// 00FB - SCR (SUPER-CHIP)
+// Scroll the display right 4 pixels.
+inline void opSCR(Chip8& c, const Chip8Instruction&)
+{
+    scrollColumns(c, 4);
+    c.PC += 2;
+}
+
+// 00FC - SCL (SUPER-CHIP)
+// Scroll the display left 4 pixels.
+inline void opSCL(Chip8& c, const Chip8Instruction&)
+{
+    scrollColumns(c, -4);
+    c.PC += 2;
+}
+
+// 00FD - EXIT (SUPER-CHIP)
+// Stop the program. PC stays put, so the machine idles here from then on.
+inline void opEXIT(Chip8&, const Chip8Instruction&) { }
+
+// Switch between the 64x32 and 128x64 displays, clearing both frames.
+inline void setResolution(Chip8& c, bool hires)
+{
+    c.hires = hires;
+    memset(c.display, 0, sizeof(c.display));
+    c.markRowsChanged(~0ull);
+}
+
+// 00FE - LOW (SUPER-CHIP)
+// Switch to the 64x32 display.
+inline void opLOW(Chip8& c, const Chip8Instruction&)
+{
+    setResolution(c, false);
+    c.PC += 2;
+}
+
+// 00FF - HIGH (SUPER-CHIP)
+// Switch to the 128x64 display.
+inline void opHIGH(Chip8& c, const Chip8Instruction&)
+{
+    setResolution(c, true);
+    c.PC += 2;
+}
+
+// 00EE - RET
+// Return from a subroutine.
+inline void opRET(Chip8& c, const Chip8Instruction&)
+{
+    if (c.SP == 0) {
+        c.trap = Chip8Trap::StackUnderflow;
+        return;
+    }
+
+    c.PC = c.stack[c.SP];
+    --c.SP;
+}
+
+// 1nnn - JP addr
+// Jump to location nnn.
+inline void opJP(Chip8& c, const Chip8Instruction& in) { c.PC = in.nnn; }
+
+// 2nnn - CALL addr
+// Call subroutine at nnn.
+inline void opCALL(Chip8& c, const Chip8Instruction& in)
+{
+    if (c.SP == 15) {
+        c.trap = Chip8Trap::StackOverflow;
+        return;
+    }
+
+    ++c.SP;
+    c.stack[c.SP] = c.PC + 2;
+    c.PC = in.nnn;
+}
+
+// 3xkk - SE Vx, byte
+// Skip next instruction if Vx = kk.
+inline void opSE_Vx_byte(Chip8& c, const Chip8Instruction& in)
+{
+    c.PC += c.V[in.x] == in.kk ? skipLength(c) : 2;
+}
+
+// 4xkk - SNE Vx, byte
+// Skip next instruction if Vx != kk.
+inline void opSNE_Vx_byte(Chip8& c, const Chip8Instruction& in)
+{
+    c.PC += c.V[in.x] != in.kk ? skipLength(c) : 2;
+}
+
+// 5xy0 - SE Vx, Vy
+// Skip next instruction if Vx = Vy.
+inline void opSE_Vx_Vy(Chip8& c, const Chip8Instruction& in)
+{
+    c.PC += c.V[in.x] == c.V[in.y] ? skipLength(c) : 2;
+}
+
+// 5xy2 - LD [I], Vx-Vy (XO-CHIP)
+// Store registers Vx through Vy, in that order, in memory starting at
+// location I. I is left unchanged.
+inline void opLD_I_Vx_Vy(Chip8& c, const Chip8Instruction& in)
+{
+    const int step = in.x <= in.y ? 1 : -1;
+    const int count = (in.y - in.x) * step + 1;
+    for (int i = 0; i < count; ++i)
+        c.storeMemory(c.I + i, c.V[in.x + i * step]);
+
+    c.PC += 2;
+}
+
+// 5xy3 - LD Vx-Vy, [I] (XO-CHIP)
+// Read registers Vx through Vy, in that order, from memory starting at
+// location I. I is left unchanged.
+inline void opLD_Vx_Vy_I(Chip8& c, const Chip8Instruction& in)
+{
+    const int step = in.x <= in.y ? 1 : -1;
+    const int count = (in.y - in.x) * step + 1;
+    for (int i = 0; i < count; ++i)
+        c.V[in.x + i * step] = c.memory[c.I + i];
+
+    c.PC += 2;
+}
+
+// 6xkk LD Vx, byte
+inline void opLD_Vx_byte(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] = in.kk;
+    c.PC += 2;
+}
+
+// 7xkk - ADD Vx, byte
+// Set Vx = Vx + kk.
+inline void opADD_Vx_byte(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] += in.kk;
+    c.PC += 2;
+}
+
+// 8xy0 - LD Vx, Vy
+// Set Vx = Vy.
+inline void opLD_Vx_Vy(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] = c.V[in.y];
+    c.PC += 2;
+}
+
+// 8xy1 - OR Vx, Vy
+// Set Vx = Vx OR Vy.
+template <Chip8Quirks Quirks>
+inline void opOR(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] |= c.V[in.y];
+    if constexpr (Quirks.logicResetsVF)
+        c.V[0xF] = 0;
+    c.PC += 2;
+}
+
+// 8xy2 - AND Vx, Vy
+// Set Vx = Vx AND Vy.
+template <Chip8Quirks Quirks>
+inline void opAND(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] &= c.V[in.y];
+    if constexpr (Quirks.logicResetsVF)
+        c.V[0xF] = 0;
+    c.PC += 2;
+}
+
+// 8xy3 - XOR Vx, Vy
+// Set Vx = Vx XOR Vy.
+template <Chip8Quirks Quirks>
+inline void opXOR(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] ^= c.V[in.y];
+    if constexpr (Quirks.logicResetsVF)
+        c.V[0xF] = 0;
+    c.PC += 2;
+}
+
+// 8xy4 - ADD Vx, Vy
+// Set Vx = Vx + Vy, set VF = carry.
+inline void opADD_Vx_Vy(Chip8& c, const Chip8Instruction& in)
+{
+    uint8_t carry = (c.V[in.x] + c.V[in.y] > 255) ? 1 : 0;
+    c.V[in.x] += c.V[in.y];
+    c.V[0xF] = carry;
+    c.PC += 2;
+}
+
+// 8xy5 - SUB Vx, Vy
+// Set Vx = Vx - Vy, set VF = NOT borrow.
+inline void opSUB(Chip8& c, const Chip8Instruction& in)
+{
+    uint8_t notBorrow = c.V[in.x] > c.V[in.y] ? 1 : 0;
+    c.V[in.x] -= c.V[in.y];
+    c.V[0xF] = notBorrow;
+    c.PC += 2;
+}
+
+// 8xy6 - SHR Vx {, Vy}
+// Set Vx = Vy SHR 1, or Vx SHR 1 without the shift quirk, and VF = the bit
+// shifted out.
+template <Chip8Quirks Quirks>
+inline void opSHR(Chip8& c, const Chip8Instruction& in)
+{
+    const uint8_t source = c.V[Quirks.shiftsVy ? in.y : in.x];
+    c.V[in.x] = source >> 1;
+    c.V[0xF] = source & 1;
+    c.PC += 2;
+}
+
+// 8xy7 - SUBN Vx, Vy
+// Set Vx = Vy - Vx, set VF = NOT borrow.
+inline void opSUBN(Chip8& c, const Chip8Instruction& in)
+{
+    uint8_t notBorrow = c.V[in.y] > c.V[in.x] ? 1 : 0;
+    c.V[in.x] = c.V[in.y] - c.V[in.x];
+    c.V[0xF] = notBorrow;
+    c.PC += 2;
+}
+
+// 8xyE - SHL Vx {, Vy}
+// Set Vx = Vy SHL 1, or Vx SHL 1 without the shift quirk, and VF = the bit
+// shifted out.
+template <Chip8Quirks Quirks>
+inline void opSHL(Chip8& c, const Chip8Instruction& in)
+{
+    const uint8_t source = c.V[Quirks.shiftsVy ? in.y : in.x];
+    c.V[in.x] = source << 1;
+    c.V[0xF] = source >> 7;
+    c.PC += 2;
+}
+
+// 9xy0 - SNE Vx, Vy
+// Skip next instruction if Vx != Vy.
+inline void opSNE_Vx_Vy(Chip8& c, const Chip8Instruction& in)
+{
+    c.PC += c.V[in.x] != c.V[in.y] ? skipLength(c) : 2;
+}
+
+// Annn - LD I, addr
+inline void opLD_I_addr(Chip8& c, const Chip8Instruction& in)
+{
+    c.I = in.nnn;
+    c.PC += 2;
+}
+
+// Bnnn - JP V0, addr
+// Jump to location nnn + V0. With the jump quirk it's Bxnn, jumping to xnn +
+// Vx.
+template <Chip8Quirks Quirks>
+inline void opJP_V0_addr(Chip8& c, const Chip8Instruction& in)
+{
+    c.PC = in.nnn + c.V[Quirks.jumpsWithVx ? in.x : 0];
+}
+
+// Cxkk - RND Vx, byte
+// Set Vx = random byte AND kk.
+inline void opRND(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] = c.random.nextByte() & in.kk;
+    c.PC += 2;
+}
+
+// A display row as one 128-bit value, its first word in the top half, so a
+// sprite row can be placed anywhere on it with one shift.
+__extension__ typedef unsigned __int128 Chip8Row;
+
+// Place a sprite row, its leftmost pixel in the top bit of sprite, at column
+// X of a display row width pixels wide (64 or 128). Pixels past the right
+// edge wrap around to the left edge when Wrap is set, or are dropped.
+template <bool Wrap>
+inline Chip8Row placeSpriteRow(uint64_t sprite, int X, int width)
+{
+    const Chip8Row wide = (Chip8Row)sprite << 64;
+    Chip8Row placed = wide >> X;
+    // What the shift pushed past the right edge, brought back in on the
+    // left. Shifted in two steps so that X = 0 isn't a shift by the width.
+    if constexpr (Wrap)
+        placed |= (wide << 1) << (width - 1 - X);
+    // In the 64-pixel mode only the first word is on screen.
+    return placed & (~(Chip8Row)0 << (128 - width));
+}
+
+// Dxyn - DRW Vx, Vy, nibble
+// Display n-byte sprite starting at memory location I at (Vx, Vy), set VF =
+// collision. Dxy0 draws a 16x16 sprite of two bytes per row (SUPER-CHIP).
+// With both XO-CHIP planes selected, the second plane's sprite follows the
+// first's in memory.
+//
+// Sprites wrap around both edges of the display with the wrap quirk, and are
+// clipped at them without. Every row is drawn without branches, and collision
+// is one OR of everything the sprite overlapped.
+template <Chip8Quirks Quirks>
+inline void opDRW(Chip8& c, const Chip8Instruction& in)
+{
+    saveDisplayFrame(c);
+
+    // The coordinates are read before VF is written, so that Vx or Vy can be
+    // VF itself.
+    const int width = displayWidth(c);
+    const int height = displayHeight(c);
+    const int X = c.V[in.x] % width;
+    const int Y = c.V[in.y] % height;
+    const bool wide = in.n == 0;
+    const int rows = wide ? 16 : in.n;
+
+    Chip8Row overlap = 0;
+    uint64_t dirtyRows = 0;
+    uint16_t address = c.I;
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        if (!(c.planeMask & (1 << plane)))
+            continue;
+
+        for (int i = 0; i < rows; ++i) {
+            uint64_t sprite = (uint64_t)c.memory[address++] << 56;
+            if (wide)
+                sprite |= (uint64_t)c.memory[address++] << 48;
+
+            Chip8Row placed
+                = placeSpriteRow<Quirks.wrapsSprites>(sprite, X, width);
+            // Rows past the bottom wrap around to the top, or are clipped
+            // by drawing nothing on the row they'd wrap to.
+            if constexpr (!Quirks.wrapsSprites)
+                placed &= -(Chip8Row)(Y + i < height);
+
+            // The height is a power of two.
+            const int row = (Y + i) & (height - 1);
+            uint64_t* bits = c.display[1].bits[plane][row];
+            const Chip8Row current = (Chip8Row)bits[0] << 64 | bits[1];
+            overlap |= placed & current;
+
+            const Chip8Row next = current ^ placed;
+            bits[0] = next >> 64;
+            bits[1] = next;
+            dirtyRows |= (uint64_t)(placed != 0) << row;
+        }
+    }
+
+    c.markRowsChanged(dirtyRows);
+    c.V[0xF] = overlap != 0;
+    c.PC += 2;
+}
+
+// Ex9E - SKP Vx
+// Skip next instruction if key with the value of Vx is pressed. Only the low
+// nibble of Vx picks the key.
+inline void opSKP(Chip8& c, const Chip8Instruction& in)
+{
+    if (c.keyboard[c.V[in.x] & 0xF]) {
+        c.PC += skipLength(c) - 2;
+    }
+    c.PC += 2;
+}
+
+// ExA1 - SKNP Vx
+// Skip next instruction if key with the value of Vx is not pressed. Only the
+// low nibble of Vx picks the key.
+inline void opSKNP(Chip8& c, const Chip8Instruction& in)
+{
+    if (!c.keyboard[c.V[in.x] & 0xF]) {
+        c.PC += skipLength(c) - 2;
+    }
+    c.PC += 2;
+}
+
+// F000 nnnn - LD I, long addr (XO-CHIP)
+// Set I = the 16-bit address in the two bytes after the opcode.
+inline void opLD_I_long(Chip8& c, const Chip8Instruction&)
+{
+    c.I = (c.memory[c.PC + 2] << 8) | c.memory[c.PC + 3];
+    c.PC += 4;
+}
+
+// Fn01 - PLANE n (XO-CHIP)
+// Select the bitplanes that drawing, clearing and scrolling affect.
+inline void opPLANE(Chip8& c, const Chip8Instruction& in)
+{
+    saveDisplayFrame(c);
+    c.planeMask = in.x & 3;
+    c.PC += 2;
+}
+
+// F002 - AUDIO (XO-CHIP)
+// Load the 16-byte audio pattern starting at memory location I.
+inline void opAUDIO(Chip8& c, const Chip8Instruction&)
+{
+    for (int i = 0; i < 16; ++i)
+        c.audioPattern[i] = c.memory[c.I + i];
+    c.PC += 2;
+}
+
+// Fx07 - LD Vx, DT
+// Set Vx = delay timer value.
+inline void opLD_Vx_DT(Chip8& c, const Chip8Instruction& in)
+{
+    c.V[in.x] = c.delayTimer;
+    c.PC += 2;
+}
+
+// Fx0A - LD Vx, K
+// Wait for a key press, store the value of the key in Vx.
+inline void opLD_Vx_K(Chip8& c, const Chip8Instruction& in)
+{
+    for (int i = 0; i < 16; ++i) {
+        if (c.keyboard[i] == true) {
+            c.V[in.x] = i;
+            c.PC += 2;
+
+            break;
+        }
+    }
+}
+
+// Fx15 - LD DT, Vx
+// Set delay timer = Vx.
+inline void opLD_DT_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    c.delayTimer = c.V[in.x];
+    c.PC += 2;
+}
+
+// Fx18 - LD ST, Vx
+// Set sound timer = Vx.
+inline void opLD_ST_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    c.soundTimer = c.V[in.x];
+    c.PC += 2;
+}
+
+// Fx1E - ADD I, Vx
+// Set I = I + Vx.
+inline void opADD_I_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    c.I += c.V[in.x];
+    c.PC += 2;
+}
+
+// Fx29 - LD F, Vx
+// Set I = location of sprite for digit Vx.
+inline void opLD_F_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    c.I = (c.V[in.x] & 0xF) * 5;
+    c.PC += 2;
+}
+
+// Fx30 - LD HF, Vx (SUPER-CHIP)
+// Set I = location of the 8x10 sprite for digit Vx.
+inline void opLD_HF_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    c.I = BIG_FONT_START + (c.V[in.x] & 0xF) * 10;
+    c.PC += 2;
+}
+
+// Fx3A - PITCH Vx (XO-CHIP)
+// Set the audio pattern's playback pitch = Vx.
+inline void opPITCH(Chip8& c, const Chip8Instruction& in)
+{
+    c.pitch = c.V[in.x];
+    c.PC += 2;
+}
+
+// Fx33 - LD B, Vx
+// Store BCD representation of Vx in memory locations I, I+1, and I+2.
+inline void opLD_B_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    uint8_t o = c.V[in.x] % 10;
+    uint8_t t = ((c.V[in.x] % 100) - o) / 10;
+    uint8_t h = ((c.V[in.x] % 1000) - t - o) / 100;
+
+    c.storeMemory(c.I, h);
+    c.storeMemory(c.I + 1, t);
+    c.storeMemory(c.I + 2, o);
+
+    c.PC += 2;
+}
+
+// Where Fx55 and Fx65 leave I.
+template <Chip8Quirks Quirks>
+inline void advanceIndex(Chip8& c, const Chip8Instruction& in)
+{
+    if constexpr (Quirks.loadStoreIndex == Chip8IndexQuirk::AddXPlusOne)
+        c.I += in.x + 1;
+    else if constexpr (Quirks.loadStoreIndex == Chip8IndexQuirk::AddX)
+        c.I += in.x;
+}
+
+// Fx55 - LD [I], Vx
+// Store registers V0 through Vx in memory starting at location I.
+template <Chip8Quirks Quirks>
+inline void opLD_I_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    for (int i = 0; i <= in.x; ++i) {
+        c.storeMemory(c.I + i, c.V[i]);
+    }
+    advanceIndex<Quirks>(c, in);
+
+    c.PC += 2;
+}
+
+// Fx65 - LD Vx, [I]
+// Read registers V0 through Vx from memory starting at location I.
+template <Chip8Quirks Quirks>
+inline void opLD_Vx_I(Chip8& c, const Chip8Instruction& in)
+{
+    for (int i = 0; i <= in.x; ++i) {
+        c.V[i] = c.memory[c.I + i];
+    }
+    advanceIndex<Quirks>(c, in);
+
+    c.PC += 2;
+}
+
+// Fx75 - LD R, Vx (SUPER-CHIP)
+// Store registers V0 through Vx in the user flags.
+inline void opLD_R_Vx(Chip8& c, const Chip8Instruction& in)
+{
+    for (int i = 0; i <= in.x; ++i)
+        c.flags[i] = c.V[i];
+    c.PC += 2;
+}
+
+// Fx85 - LD Vx, R (SUPER-CHIP)
+// Read registers V0 through Vx from the user flags.
+inline void opLD_Vx_R(Chip8& c, const Chip8Instruction& in)
+{
+    for (int i = 0; i <= in.x; ++i)
+        c.V[i] = c.flags[i];
+    c.PC += 2;
+}
+
+inline void opInvalid(Chip8& c, const Chip8Instruction&)
+{
+    c.trap = Chip8Trap::InvalidOpcode;
+}
+
+// Decode an opcode to its handler under Quirks and pass that to `visit`. This
+// is the one place the instruction set is decoded: the switch engine visits
+// with a call, which inlines straight into its switch, while the predecoded
+// engine visits to capture the handler pointer for its cache.
+template <Chip8Quirks Quirks, typename Visitor>
+inline void visitHandler(uint16_t opcode, Visitor&& visit)
+{
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00EE)
+            visit(opRET);
+        else if (opcode == 0x00E0)
+            visit(opCLS);
+        else if ((opcode & 0xFFF0) == 0x00C0)
+            visit(opSCD);
+        else if ((opcode & 0xFFF0) == 0x00D0)
+            visit(opSCU);
+        else if (opcode == 0x00FB)
+            visit(opSCR);
+        else if (opcode == 0x00FC)
+            visit(opSCL);
+        else if (opcode == 0x00FD)
+            visit(opEXIT);
+        else if (opcode == 0x00FE)
+            visit(opLOW);
+        else if (opcode == 0x00FF)
+            visit(opHIGH);
+        else
+            visit(opSYS);
+        break;
+    case 0x1000:
+        visit(opJP);
+        break;
+    case 0x2000:
+        visit(opCALL);
+        break;
+    case 0x3000:
+        visit(opSE_Vx_byte);
+        break;
+    case 0x4000:
+        visit(opSNE_Vx_byte);
+        break;
+    case 0x5000:
+        if ((opcode & 0x000F) == 0x2)
+            visit(opLD_I_Vx_Vy);
+        else if ((opcode & 0x000F) == 0x3)
+            visit(opLD_Vx_Vy_I);
+        else
+            visit(opSE_Vx_Vy);
+        break;
+    case 0x6000:
+        visit(opLD_Vx_byte);
+        break;
+    case 0x7000:
+        visit(opADD_Vx_byte);
+        break;
+    case 0x8000:
+        switch (opcode & 0x000F) {
+        case 0:
+            visit(opLD_Vx_Vy);
+            break;
+        case 1:
+            visit(opOR<Quirks>);
+            break;
+        case 2:
+            visit(opAND<Quirks>);
+            break;
+        case 3:
+            visit(opXOR<Quirks>);
+            break;
+        case 4:
+            visit(opADD_Vx_Vy);
+            break;
+        case 5:
+            visit(opSUB);
+            break;
+        case 6:
+            visit(opSHR<Quirks>);
+            break;
+        case 7:
+            visit(opSUBN);
+            break;
+        case 0xE:
+            visit(opSHL<Quirks>);
+            break;
+        default:
+            visit(opInvalid);
+            break;
+        }
+        break;
+    case 0x9000:
+        visit(opSNE_Vx_Vy);
+        break;
+    case 0xA000:
+        visit(opLD_I_addr);
+        break;
+    case 0xB000:
+        visit(opJP_V0_addr<Quirks>);
+        break;
+    case 0xC000:
+        visit(opRND);
+        break;
+    case 0xD000:
+        visit(opDRW<Quirks>);
+        break;
+    case 0xE000:
+        switch (opcode & 0x00FF) {
+        case 0x009E:
+            visit(opSKP);
+            break;
+        case 0x00A1:
+            visit(opSKNP);
+            break;
+        default:
+            visit(opInvalid);
+            break;
+        }
+        break;
+    case 0xF000:
+        if (opcode == 0xF000) {
+            visit(opLD_I_long);
+            break;
+        }
+        if (opcode == 0xF002) {
+            visit(opAUDIO);
+            break;
+        }
+        switch (opcode & 0xF0FF) {
+        case 0xF001:
+            visit(opPLANE);
+            break;
+        case 0xF007:
+            visit(opLD_Vx_DT);
+            break;
+        case 0xF00A:
+            visit(opLD_Vx_K);
+            break;
+        case 0xF015:
+            visit(opLD_DT_Vx);
+            break;
+        case 0xF018:
+            visit(opLD_ST_Vx);
+            break;
+        case 0xF01E:
+            visit(opADD_I_Vx);
+            break;
+        case 0xF029:
+            visit(opLD_F_Vx);
+            break;
+        case 0xF030:
+            visit(opLD_HF_Vx);
+            break;
+        case 0xF03A:
+            visit(opPITCH);
+            break;
+        case 0xF033:
+            visit(opLD_B_Vx);
+            break;
+        case 0xF055:
+            visit(opLD_I_Vx<Quirks>);
+            break;
+        case 0xF065:
+            visit(opLD_Vx_I<Quirks>);
+            break;
+        case 0xF075:
+            visit(opLD_R_Vx);
+            break;
+        case 0xF085:
+            visit(opLD_Vx_R);
+            break;
+        default:
+            visit(opInvalid);
+            break;
+        }
+        break;
+    }
+}
+
+// Fetch, decode and execute the instruction at PC.
+template <Chip8Quirks Quirks>
+inline void stepInstruction(Chip8& c)
+{
+    const Chip8Instruction in
+        = decodeOperands((c.memory[c.PC] << 8) | c.memory[c.PC + 1]);
+
+    visitHandler<Quirks>(
+        in.opcode, [&](Chip8Handler handler) { handler(c, in); });
+}
@@ -0,0 +1,37 @@
+#include "chip8_pool.h"
+
+#include <new>
+
+Chip8Pool::Chip8Pool(size_t capacity)
+    : machines(static_cast<Chip8*>(::operator new(
+        capacity * sizeof(Chip8), std::align_val_t(alignof(Chip8)))))
+    , slots(capacity)
+{
+}
+
+Chip8Pool::~Chip8Pool()
+{
+    while (count > 0)
+        machines[--count].~Chip8();
+    ::operator delete(machines, std::align_val_t(alignof(Chip8)));
+}
+
+Chip8* Chip8Pool::create(
+    const std::string& romFilepath, uint64_t seed, Chip8Profile profile)
+{
+    if (count == slots)
+        return nullptr;
+    Chip8* machine
+        = new (&machines[count]) Chip8(romFilepath, seed, profile);
+    ++count;
+    return machine;
+}
+
+Chip8* Chip8Pool::fork(const Chip8& parent)
+{
+    if (count == slots)
+        return nullptr;
+    Chip8* machine = new (&machines[count]) Chip8(parent);
+    ++count;
+    return machine;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// A fixed number of machines allocated back to back from one arena.
+//
+// Every Chip8 starts on a cache-line boundary with its registers, stack and
+// cycle count in that first line, and its memory page table and display on
+// the lines after it (see chip8.h). Placing the machines contiguously keeps
+// a batch of them in as few pages as possible and stops one machine's hot
+// line from sharing a cache line with another's cold data, so running many
+// machines in turn on one core, or side by side on several, doesn't thrash
+// L1/L2 or false-share.
+
+#include "chip8.h"
+
+#include <cstddef>
+#include <string>
+
+class Chip8Pool
+{
+public:
+    explicit Chip8Pool(size_t capacity);
+    ~Chip8Pool();
+
+    Chip8Pool(const Chip8Pool&) = delete;
+    Chip8Pool& operator=(const Chip8Pool&) = delete;
+
+    // Construct a machine in the next free slot, or return nullptr if the
+    // pool is full. Machines live until the pool is destroyed.
+    Chip8* create(const std::string& romFilepath,
+        uint64_t seed = DEFAULT_RANDOM_SEED,
+        Chip8Profile profile = DEFAULT_PROFILE);
+
+    // The same, but for a copy of parent as Chip8::fork() makes one.
+    Chip8* fork(const Chip8& parent);
+
+    size_t size() const { return count; }
+    size_t capacity() const { return slots; }
+
+    Chip8& operator[](size_t index) { return machines[index]; }
+    const Chip8& operator[](size_t index) const { return machines[index]; }
+
+private:
+    Chip8* machines;
+    size_t slots;
+    size_t count = 0;
+};
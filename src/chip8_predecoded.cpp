@@ -0,0 +1,58 @@
+// The predecoded engine.
+//
+// Rather than fetching and decoding at every step, each even address in
+// memory has a cache entry holding the handler for the instruction there and
+// its operands. Entries start out pointing at decodePredecoded, which fills
+// the entry in on first execution; storeMemory() resets entries back to it
+// when the bytes under them change, so self-modifying ROMs stay correct.
+// The cached handlers are the instantiations for the machine's quirk profile,
+// so only decoding looks at which profile that is.
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+static constexpr int PREDECODED_ENTRIES = 4096 / 2;
+
+uint64_t Chip8::runPredecoded(uint64_t n)
+{
+    if (!predecoded) {
+        predecoded.reset(new Chip8DecodedInstruction[PREDECODED_ENTRIES]);
+        for (int i = 0; i < PREDECODED_ENTRIES; ++i)
+            predecoded[i].handler = decodePredecoded;
+    }
+
+    const Chip8DecodedInstruction* cache = predecoded.get();
+
+    for (uint64_t i = 0; i < n; ++i) {
+        if ((PC & 1) || PC >= 4096)
+            step();
+        else {
+            const Chip8DecodedInstruction& entry = cache[PC >> 1];
+            entry.handler(*this, entry.instruction);
+        }
+        if (trap != Chip8Trap::None)
+            return i + 1;
+    }
+    return n;
+}
+
+void Chip8::invalidatePredecoded(uint16_t address)
+{
+    predecoded[address >> 1].handler = decodePredecoded;
+}
+
+// The handler of every entry that hasn't been decoded yet. It is only ever
+// reached with PC at the entry's address.
+void Chip8::decodePredecoded(Chip8& c, const Chip8Instruction&)
+{
+    Chip8DecodedInstruction& entry = c.predecoded[c.PC >> 1];
+
+    entry.instruction
+        = decodeOperands((c.memory[c.PC] << 8) | c.memory[c.PC + 1]);
+    visitQuirks(c.quirksProfile, [&]<Chip8Quirks Quirks>() {
+        visitHandler<Quirks>(entry.instruction.opcode,
+            [&](Chip8Handler handler) { entry.handler = handler; });
+    });
+
+    entry.handler(c, entry.instruction);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+// Quirk profiles: the instructions whose behaviour differs between the
+// CHIP-8 interpreters ROMs were written for.
+//
+// A machine's profile is picked when its ROM is loaded and never changes.
+// The instruction handlers in chip8_ops.h take the profile's Chip8Quirks as a
+// template parameter, so every engine is instantiated once per profile and
+// the quirks are constants in the code they run, rather than flags tested on
+// every instruction. visitQuirks() picks the instantiation for a machine.
+
+#include <string>
+#include <vector>
+
+enum class Chip8Profile
+{
+    // The original interpreter on the RCA COSMAC VIP.
+    Vip,
+    // CHIP-48 on the HP-48 calculators.
+    Chip48,
+    // SUPER-CHIP 1.1, also on the HP-48.
+    Schip,
+    // Octo's XO-CHIP.
+    XoChip,
+};
+
+constexpr Chip8Profile DEFAULT_PROFILE = Chip8Profile::Vip;
+
+// What Fx55 and Fx65 leave in I.
+enum class Chip8IndexQuirk
+{
+    // I + x + 1, just past the last register.
+    AddXPlusOne,
+    // I + x, at the last register.
+    AddX,
+    // I itself.
+    Unchanged,
+};
+
+struct Chip8Quirks
+{
+    // 8xy6 and 8xyE shift Vy into Vx, rather than shifting Vx in place.
+    bool shiftsVy;
+    // 8xy1, 8xy2 and 8xy3 clear VF.
+    bool logicResetsVF;
+    Chip8IndexQuirk loadStoreIndex;
+    // Bxnn jumps to xnn + Vx, rather than Bnnn jumping to nnn + V0.
+    bool jumpsWithVx;
+    // Sprite rows past the bottom of the display wrap around to the top,
+    // rather than being clipped.
+    bool wrapsSprites;
+};
+
+constexpr Chip8Quirks VIP_QUIRKS
+    = { true, true, Chip8IndexQuirk::AddXPlusOne, false, false };
+constexpr Chip8Quirks CHIP48_QUIRKS
+    = { false, false, Chip8IndexQuirk::AddX, true, false };
+constexpr Chip8Quirks SCHIP_QUIRKS
+    = { false, false, Chip8IndexQuirk::Unchanged, true, false };
+constexpr Chip8Quirks XOCHIP_QUIRKS
+    = { true, false, Chip8IndexQuirk::AddXPlusOne, false, true };
+
+constexpr Chip8Quirks quirksOf(Chip8Profile profile)
+{
+    switch (profile) {
+    case Chip8Profile::Chip48:
+        return CHIP48_QUIRKS;
+    case Chip8Profile::Schip:
+        return SCHIP_QUIRKS;
+    case Chip8Profile::XoChip:
+        return XOCHIP_QUIRKS;
+    default:
+        return VIP_QUIRKS;
+    }
+}
+
+// Call visit.template operator()<Quirks>() with profile's quirks: the one
+// run-time branch that selects which instantiation of an engine runs.
+template <typename Visitor>
+inline void visitQuirks(Chip8Profile profile, Visitor&& visit)
+{
+    switch (profile) {
+    case Chip8Profile::Vip:
+        visit.template operator()<VIP_QUIRKS>();
+        break;
+    case Chip8Profile::Chip48:
+        visit.template operator()<CHIP48_QUIRKS>();
+        break;
+    case Chip8Profile::Schip:
+        visit.template operator()<SCHIP_QUIRKS>();
+        break;
+    case Chip8Profile::XoChip:
+        visit.template operator()<XOCHIP_QUIRKS>();
+        break;
+    }
+}
+
+// Every profile, in the order above.
+const std::vector<Chip8Profile>& availableProfiles();
+
+const char* profileName(Chip8Profile profile);
+bool parseProfileName(const std::string& name, Chip8Profile& profile);
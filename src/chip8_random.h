@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Seed used when none is given, so that runs are reproducible by default.
+constexpr uint64_t DEFAULT_RANDOM_SEED = 0x853C49E6748FEA9Bull;
+
+// PCG32 (XSH RR variant, see https://www.pcg-random.org): 64 bits of state,
+// 32-bit output, a multiply and a rotate per number. Every machine owns one,
+// so machines on different threads never contend on a shared generator, and
+// the same seed always gives the same sequence.
+class Chip8Random
+{
+public:
+    explicit Chip8Random(uint64_t seed = DEFAULT_RANDOM_SEED)
+    {
+        state = 0;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next()
+    {
+        const uint64_t old = state;
+        state = old * 6364136223846793005ull + INCREMENT;
+        const uint32_t xorShifted = ((old >> 18) ^ old) >> 27;
+        const uint32_t rotation = old >> 59;
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+    }
+
+    // A uniformly distributed byte, 0 to 255 inclusive.
+    uint8_t nextByte() { return next() >> 24; }
+
+    // The generator's whole state; equal states produce equal sequences.
+    uint64_t state;
+
+private:
+    static constexpr uint64_t INCREMENT = 1442695040888963407ull;
+};
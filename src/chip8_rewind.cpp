@@ -0,0 +1,177 @@
+#include "chip8_rewind.h"
+
+#include <cstring>
+
+Chip8Rewind::Chip8Rewind(const Chip8& machine, size_t arenaSize)
+    : arena(new uint8_t[arenaSize < MAX_RECORD_SIZE ? MAX_RECORD_SIZE
+                                                    : arenaSize])
+    , arenaSize(arenaSize < MAX_RECORD_SIZE ? MAX_RECORD_SIZE : arenaSize)
+    , recordCapacity(this->arenaSize / sizeof(RecordHeader))
+{
+    records.reset(new Record[recordCapacity]);
+
+    registers = registersOf(machine);
+    for (int page = 0; page < PAGES; ++page)
+        memcpy(memory + page * PAGE_SIZE, machine.memory.page(page),
+            PAGE_SIZE);
+    memcpy(display, machine.display, sizeof(display));
+}
+
+Chip8Rewind::Registers Chip8Rewind::registersOf(const Chip8& machine)
+{
+    Registers r;
+    memset(&r, 0, sizeof(r));
+    memcpy(r.V, machine.V, sizeof(r.V));
+    r.I = machine.I;
+    r.PC = machine.PC;
+    r.SP = machine.SP;
+    memcpy(r.stack, machine.stack, sizeof(r.stack));
+    r.delayTimer = machine.delayTimer;
+    r.soundTimer = machine.soundTimer;
+    r.hires = machine.hires;
+    r.planeMask = machine.planeMask;
+    memcpy(r.flags, machine.flags, sizeof(r.flags));
+    memcpy(r.audioPattern, machine.audioPattern, sizeof(r.audioPattern));
+    r.pitch = machine.pitch;
+    r.randomState = machine.random.state;
+    return r;
+}
+
+void Chip8Rewind::reserve(size_t offset, size_t size)
+{
+    while (count > 0) {
+        const Record& oldest = records[first];
+        const bool overlaps = oldest.offset < offset + size
+            && offset < oldest.offset + oldest.size;
+        if (!overlaps && count < recordCapacity)
+            break;
+
+        first = (first + 1) % recordCapacity;
+        --count;
+    }
+}
+
+void Chip8Rewind::capture(const Chip8& machine)
+{
+    // Records are written in order around the arena; one that might not fit
+    // before the end starts over at the beginning.
+    if (writeOffset + MAX_RECORD_SIZE > arenaSize)
+        writeOffset = 0;
+    reserve(writeOffset, MAX_RECORD_SIZE);
+
+    uint8_t* out = arena.get() + writeOffset;
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.registers = registers;
+    registers = registersOf(machine);
+
+    size_t size = sizeof(header);
+
+    // The old contents of whatever changed, updating the copy as we go.
+    for (int page = 0; page < PAGES; ++page) {
+        uint8_t* old = memory + page * PAGE_SIZE;
+        const uint8_t* now = machine.memory.page(page);
+        if (memcmp(old, now, PAGE_SIZE) == 0)
+            continue;
+
+        header.changedPages[page / 64] |= 1ull << (page % 64);
+        memcpy(out + size, old, PAGE_SIZE);
+        memcpy(old, now, PAGE_SIZE);
+        size += PAGE_SIZE;
+    }
+
+    for (int d = 0; d < 2; ++d) {
+        uint64_t* words = &display[d].bits[0][0][0];
+        const uint64_t* nowWords = &machine.display[d].bits[0][0][0];
+        for (int word = 0; word < Chip8Display::WORDS; ++word) {
+            uint64_t& old = words[word];
+            if (old == nowWords[word])
+                continue;
+
+            header.changedWords[d][word / 64] |= 1ull << (word % 64);
+            memcpy(out + size, &old, sizeof(old));
+            old = nowWords[word];
+            size += sizeof(old);
+        }
+    }
+
+    memcpy(out, &header, sizeof(header));
+
+    records[(first + count) % recordCapacity] = { writeOffset, size };
+    ++count;
+    writeOffset += size;
+}
+
+bool Chip8Rewind::rewind(Chip8& machine)
+{
+    const bool haveHistory = count > 0;
+
+    if (haveHistory) {
+        // Undo the newest record on the copy of the last capture.
+        --count;
+        const Record& record = records[(first + count) % recordCapacity];
+        const uint8_t* in = arena.get() + record.offset;
+
+        RecordHeader header;
+        memcpy(&header, in, sizeof(header));
+        size_t offset = sizeof(header);
+
+        registers = header.registers;
+
+        for (int page = 0; page < PAGES; ++page) {
+            if (header.changedPages[page / 64] & (1ull << (page % 64))) {
+                memcpy(memory + page * PAGE_SIZE, in + offset, PAGE_SIZE);
+                offset += PAGE_SIZE;
+            }
+        }
+
+        for (int d = 0; d < 2; ++d) {
+            uint64_t* words = &display[d].bits[0][0][0];
+            for (int word = 0; word < Chip8Display::WORDS; ++word) {
+                const uint64_t bit = 1ull << (word % 64);
+                if (header.changedWords[d][word / 64] & bit) {
+                    memcpy(&words[word], in + offset, sizeof(uint64_t));
+                    offset += sizeof(uint64_t);
+                }
+            }
+        }
+
+        // The next record goes where this one was, keeping the arena in
+        // order.
+        writeOffset = record.offset;
+    }
+
+    // Then copy it into the machine, which may have moved on since.
+    memcpy(machine.V, registers.V, sizeof(machine.V));
+    machine.I = registers.I;
+    machine.PC = registers.PC;
+    machine.SP = registers.SP;
+    memcpy(machine.stack, registers.stack, sizeof(machine.stack));
+    machine.delayTimer = registers.delayTimer;
+    machine.soundTimer = registers.soundTimer;
+    machine.trap = Chip8Trap::None;
+    machine.hires = registers.hires;
+    machine.planeMask = registers.planeMask;
+    memcpy(machine.flags, registers.flags, sizeof(machine.flags));
+    memcpy(machine.audioPattern, registers.audioPattern,
+        sizeof(machine.audioPattern));
+    machine.pitch = registers.pitch;
+    machine.random.state = registers.randomState;
+    memcpy(machine.display, display, sizeof(machine.display));
+    machine.markRowsChanged(~0ull);
+
+    for (int page = 0; page < PAGES; ++page) {
+        const uint8_t* then = memory + page * PAGE_SIZE;
+        const uint8_t* now = machine.memory.page(page);
+        if (memcmp(then, now, PAGE_SIZE) == 0)
+            continue;
+
+        for (int i = 0; i < PAGE_SIZE; ++i) {
+            if (now[i] != then[i])
+                machine.storeMemory(page * PAGE_SIZE + i, then[i]);
+        }
+    }
+
+    return haveHistory;
+}
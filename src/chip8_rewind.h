@@ -0,0 +1,100 @@
+#pragma once
+
+// Rewind history for a Chip8 machine.
+//
+// capture() is called once per frame and records how to get from the new
+// state back to the previously captured one: the old registers, plus the old
+// contents of just the 256-byte memory pages and 64-bit display words that
+// changed. Records go into a ring arena allocated up front, so capturing never
+// allocates; once the arena is full the oldest frames are dropped. A frame
+// that only touches registers and a few rows costs around 200 bytes, so a few
+// MB hold minutes of history.
+
+#include "chip8.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class Chip8Rewind
+{
+public:
+    static constexpr size_t DEFAULT_ARENA_SIZE = 4 << 20;
+
+    // Start the history at machine's current state.
+    explicit Chip8Rewind(
+        const Chip8& machine, size_t arenaSize = DEFAULT_ARENA_SIZE);
+
+    // Record a frame: the changes since the previous capture.
+    void capture(const Chip8& machine);
+
+    // Put machine back to the frame captured before the most recent one,
+    // dropping whatever it did since. Returns false, after restoring the
+    // most recent capture, when there is no older history left. Either way
+    // any trap is cleared.
+    bool rewind(Chip8& machine);
+
+    // How many frames back rewind() can currently go.
+    size_t frames() const { return count; }
+
+private:
+    // Everything but memory and the display, which are stored in pages and
+    // words. The keyboard is live input rather than history, so it's left
+    // out.
+    struct Registers
+    {
+        uint8_t V[16];
+        uint16_t I;
+        uint16_t PC;
+        uint8_t SP;
+        uint16_t stack[16];
+        uint8_t delayTimer;
+        uint8_t soundTimer;
+        bool hires;
+        uint8_t planeMask;
+        uint8_t flags[16];
+        uint8_t audioPattern[16];
+        uint8_t pitch;
+        uint64_t randomState;
+    };
+
+    struct RecordHeader
+    {
+        // Bit sets over the words of each display and the pages of memory.
+        uint64_t changedWords[2][Chip8Display::WORDS / 64];
+        uint64_t changedPages[Chip8Memory::PAGES / 64];
+        Registers registers;
+    };
+
+    struct Record
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    static constexpr int PAGE_SIZE = Chip8Memory::PAGE_SIZE;
+    static constexpr int PAGES = Chip8Memory::PAGES;
+    static constexpr size_t MAX_RECORD_SIZE
+        = sizeof(RecordHeader) + Chip8Memory::SIZE + sizeof(Chip8Display) * 2;
+
+    static Registers registersOf(const Chip8& machine);
+
+    // Drop the oldest records until [offset, offset + size) is free.
+    void reserve(size_t offset, size_t size);
+
+    // The state as of the last capture.
+    Registers registers;
+    uint8_t memory[Chip8Memory::SIZE];
+    Chip8Display display[2];
+
+    std::unique_ptr<uint8_t[]> arena;
+    size_t arenaSize;
+    // Where the next record goes.
+    size_t writeOffset = 0;
+
+    // Ring of records, oldest first.
+    std::unique_ptr<Record[]> records;
+    size_t recordCapacity;
+    size_t first = 0;
+    size_t count = 0;
+};
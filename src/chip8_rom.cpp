@@ -0,0 +1,129 @@
+#include "chip8_rom.h"
+#include "chip8.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void writeFont(uint8_t* image)
+{
+    for (int spriteIdx = 0; spriteIdx < 16; ++spriteIdx) {
+        for (int spriteLineIdx = 0; spriteLineIdx < 5; ++spriteLineIdx) {
+            image[spriteIdx * 5 + spriteLineIdx]
+                = NUMBER_SPRITES[spriteIdx][spriteLineIdx];
+        }
+        for (int spriteLineIdx = 0; spriteLineIdx < 10; ++spriteLineIdx) {
+            image[BIG_FONT_START + spriteIdx * 10 + spriteLineIdx]
+                = BIG_NUMBER_SPRITES[spriteIdx][spriteLineIdx];
+        }
+    }
+}
+
+static uint64_t hashImage(const uint8_t* image)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int i = 0; i < Chip8Memory::SIZE; ++i) {
+        hash ^= image[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+Chip8MemoryImage::Chip8MemoryImage(const uint8_t* bytes)
+    : memory(bytes)
+    , hash(hashImage(bytes))
+{
+}
+
+Chip8RomCache& Chip8RomCache::shared()
+{
+    static Chip8RomCache cache;
+    return cache;
+}
+
+std::shared_ptr<const Chip8MemoryImage> Chip8RomCache::blankImage()
+{
+    static const std::shared_ptr<const Chip8MemoryImage> blank = [] {
+        std::vector<uint8_t> bytes(Chip8Memory::SIZE);
+        writeFont(bytes.data());
+        return std::make_shared<const Chip8MemoryImage>(bytes.data());
+    }();
+    return blank;
+}
+
+std::shared_ptr<const Chip8MemoryImage> Chip8RomCache::load(
+    const std::string& path, Chip8Profile profile)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to read file: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        fprintf(stderr, "Failed to read file: %s\n", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    if (info.st_size == 0 || (size_t)info.st_size > maxRomSize(profile)) {
+        fprintf(stderr, "ROM is %lld bytes, expected 1 to %zu for %s: %s\n",
+            (long long)info.st_size, maxRomSize(profile),
+            profileName(profile), path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+#ifdef __APPLE__
+    const struct timespec& modified = info.st_mtimespec;
+#else
+    const struct timespec& modified = info.st_mtim;
+#endif
+    const FileKey key { (uint64_t)info.st_dev, (uint64_t)info.st_ino,
+        (uint64_t)info.st_size, (int64_t)modified.tv_sec,
+        (int64_t)modified.tv_nsec };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto cached = byFile.find(key);
+        if (cached != byFile.end()) {
+            close(fd);
+            return cached->second;
+        }
+    }
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to read file: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    std::vector<uint8_t> bytes(Chip8Memory::SIZE);
+    writeFont(bytes.data());
+    memcpy(bytes.data() + ROM_START, mapping, info.st_size);
+    munmap(mapping, info.st_size);
+    auto image = std::make_shared<const Chip8MemoryImage>(bytes.data());
+
+    // Share the image with any other ROM that has the same contents.
+    std::shared_ptr<const Chip8MemoryImage> result = image;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [first, last] = byContent.equal_range(image->hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second->memory == image->memory) {
+            result = it->second;
+            break;
+        }
+    }
+    if (result == image)
+        byContent.emplace(image->hash, result);
+    byFile.emplace(key, result);
+    return result;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// ROM loading.
+//
+// A ROM is turned into the image of memory a machine starts from: the small
+// font sprites at 0x000, the SUPER-CHIP big font at 0x050 and the ROM at
+// 0x200. Images are cached for the whole process and shared between
+// machines, so running many instances of the same ROM reads the file once,
+// and ROMs with identical contents share one image.
+
+#include "chip8_memory.h"
+#include "chip8_quirks.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+// Memory as a machine starts out. Machines running the ROM start out sharing
+// all of its pages.
+struct Chip8MemoryImage
+{
+    // From the Chip8Memory::SIZE bytes at bytes.
+    explicit Chip8MemoryImage(const uint8_t* bytes);
+
+    Chip8Memory memory;
+    // Identifies the image in save states; kept here since it takes reading
+    // all of memory.
+    uint64_t hash;
+};
+
+class Chip8RomCache
+{
+public:
+    // Programs start at 0x200. Only XO-CHIP programs can go past 0xFFF, up
+    // to the end of memory.
+    static constexpr uint16_t ROM_START = 0x200;
+
+    // The size of the largest program that fits in memory under profile.
+    static constexpr size_t maxRomSize(Chip8Profile profile)
+    {
+        return (profile == Chip8Profile::XoChip ? Chip8Memory::SIZE : 0x1000)
+            - ROM_START;
+    }
+
+    // The cache every Chip8 loads its ROM through. Safe to use from any
+    // thread.
+    static Chip8RomCache& shared();
+
+    // The memory image for the ROM at path, to run under profile. Returns
+    // nullptr, after printing why, if the file can't be read, is empty or
+    // doesn't fit in the memory profile has.
+    std::shared_ptr<const Chip8MemoryImage> load(
+        const std::string& path, Chip8Profile profile);
+
+    // The image of memory with no ROM loaded: just the font sprites.
+    static std::shared_ptr<const Chip8MemoryImage> blankImage();
+
+private:
+    // Identifies a file's contents without reading them, so an unchanged
+    // file is never read twice.
+    typedef std::tuple<uint64_t, uint64_t, uint64_t, int64_t, int64_t>
+        FileKey;
+
+    std::mutex mutex;
+    std::map<FileKey, std::shared_ptr<const Chip8MemoryImage>> byFile;
+    std::unordered_multimap<uint64_t, std::shared_ptr<const Chip8MemoryImage>>
+        byContent;
+};
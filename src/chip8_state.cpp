@@ -0,0 +1,353 @@
+// Save states.
+//
+// A snapshot is a versioned little-endian byte string:
+//
+//   "C8ST" version
+//   hash of the ROM image memory started out as (8 bytes)
+//   quirk profile (1 byte)
+//   V[16] I PC SP stack[16] delayTimer soundTimer keyboard random
+//   hires planeMask flags[16] audioPattern[16] pitch
+//   display[1]: mask of non-zero words (4 varints), then those words
+//   display[0]: mask of words that differ from display[1], then those words
+//   memory: runs of bytes that differ from the ROM image, each as
+//           <varint gap since the previous run> <varint length> <bytes>,
+//           ended by a run of length 0
+//
+// Most of memory is still the ROM image and most of the display is blank or
+// the same in both frames, so a snapshot is usually a few hundred bytes.
+
+#include "chip8.h"
+
+#include <cstring>
+#include <vector>
+
+static constexpr char STATE_MAGIC[4] = { 'C', '8', 'S', 'T' };
+static constexpr uint8_t STATE_VERSION = 3;
+
+// Selects words of a Chip8Display.
+typedef uint64_t WordMask[Chip8Display::WORDS / 64];
+
+namespace {
+
+// Bytes of a snapshot's memory that differ from the ROM image, still in the
+// snapshot.
+struct MemoryRun
+{
+    int address;
+    int length;
+    const uint8_t* bytes;
+
+    int end() const { return address + length; }
+};
+
+class StateWriter
+{
+public:
+    explicit StateWriter(std::vector<uint8_t>& out)
+        : out(out)
+    {
+    }
+
+    void bytes(const void* data, size_t size)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+
+    void integer(uint64_t value, int size)
+    {
+        for (int i = 0; i < size; ++i)
+            out.push_back(value >> (8 * i));
+    }
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            out.push_back(value | 0x80);
+            value >>= 7;
+        }
+        out.push_back(value);
+    }
+
+    // Write a mask of which words of display are selected, then just those
+    // words. The mask is varints, as most of it is usually zero.
+    void words(const Chip8Display& display, const WordMask selected)
+    {
+        const uint64_t* bits = &display.bits[0][0][0];
+        for (int i = 0; i < Chip8Display::WORDS / 64; ++i)
+            varint(selected[i]);
+        for (int word = 0; word < Chip8Display::WORDS; ++word) {
+            if (selected[word / 64] & (1ull << (word % 64)))
+                integer(bits[word], 8);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out;
+};
+
+// Every read fails once the input runs out; callers check ok() at the end.
+class StateReader
+{
+public:
+    StateReader(const uint8_t* data, size_t size)
+        : p(data)
+        , end(data + size)
+    {
+    }
+
+    bool ok() const { return !failed; }
+    bool atEnd() const { return p == end; }
+
+    void bytes(void* data, size_t size)
+    {
+        const uint8_t* source = skip(size);
+        if (source == nullptr)
+            memset(data, 0, size);
+        else
+            memcpy(data, source, size);
+    }
+
+    // Step over size bytes and return where they start in the input, or
+    // nullptr if there aren't that many left.
+    const uint8_t* skip(size_t size)
+    {
+        if (failed || (size_t)(end - p) < size) {
+            failed = true;
+            return nullptr;
+        }
+        const uint8_t* start = p;
+        p += size;
+        return start;
+    }
+
+    uint64_t integer(int size)
+    {
+        uint8_t buffer[8];
+        bytes(buffer, size);
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i)
+            value |= (uint64_t)buffer[i] << (8 * i);
+        return value;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const uint8_t byte = integer(1);
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        failed = true;
+        return 0;
+    }
+
+    // Read words written by StateWriter::words(); unselected ones are left.
+    void words(Chip8Display& display)
+    {
+        uint64_t* bits = &display.bits[0][0][0];
+        WordMask selected;
+        for (int i = 0; i < Chip8Display::WORDS / 64; ++i)
+            selected[i] = varint();
+        for (int word = 0; word < Chip8Display::WORDS; ++word) {
+            if (selected[word / 64] & (1ull << (word % 64)))
+                bits[word] = integer(8);
+        }
+    }
+
+    void fail() { failed = true; }
+
+private:
+    const uint8_t* p;
+    const uint8_t* end;
+    bool failed = false;
+};
+
+}
+
+std::vector<uint8_t> Chip8::saveState() const
+{
+    std::vector<uint8_t> snapshot;
+    snapshot.reserve(512);
+    StateWriter out(snapshot);
+
+    out.bytes(STATE_MAGIC, sizeof(STATE_MAGIC));
+    out.integer(STATE_VERSION, 1);
+    out.integer(romImage->hash, 8);
+    out.integer((uint8_t)quirksProfile, 1);
+
+    out.bytes(V, sizeof(V));
+    out.integer(I, 2);
+    out.integer(PC, 2);
+    out.integer(SP, 1);
+    for (uint16_t address : stack)
+        out.integer(address, 2);
+    out.integer(delayTimer, 1);
+    out.integer(soundTimer, 1);
+    uint16_t keys = 0;
+    for (int i = 0; i < 16; ++i)
+        keys |= keyboard[i] << i;
+    out.integer(keys, 2);
+    out.integer(random.state, 8);
+    out.integer(hires, 1);
+    out.integer(planeMask, 1);
+    out.bytes(flags, sizeof(flags));
+    out.bytes(audioPattern, sizeof(audioPattern));
+    out.integer(pitch, 1);
+
+    WordMask litWords = {};
+    WordMask changedWords = {};
+    const uint64_t* current = &display[1].bits[0][0][0];
+    const uint64_t* previous = &display[0].bits[0][0][0];
+    for (int word = 0; word < Chip8Display::WORDS; ++word) {
+        if (current[word] != 0)
+            litWords[word / 64] |= 1ull << (word % 64);
+        if (previous[word] != current[word])
+            changedWords[word / 64] |= 1ull << (word % 64);
+    }
+    out.words(display[1], litWords);
+    out.words(display[0], changedWords);
+
+    const Chip8Memory& image = romImage->memory;
+    int previousEnd = 0;
+    for (int address = 0; address < Chip8Memory::SIZE;) {
+        // Pages still shared with the image hold nothing to save.
+        const int page = address / Chip8Memory::PAGE_SIZE;
+        if (address % Chip8Memory::PAGE_SIZE == 0
+            && memory.page(page) == image.page(page)) {
+            address += Chip8Memory::PAGE_SIZE;
+            continue;
+        }
+        if (memory[address] == image[address]) {
+            ++address;
+            continue;
+        }
+
+        int runEnd = address;
+        while (runEnd < Chip8Memory::SIZE && memory[runEnd] != image[runEnd])
+            ++runEnd;
+
+        out.varint(address - previousEnd);
+        out.varint(runEnd - address);
+        for (int i = address; i < runEnd; ++i)
+            out.integer(memory[i], 1);
+        previousEnd = address = runEnd;
+    }
+    out.varint(0);
+    out.varint(0);
+
+    return snapshot;
+}
+
+bool Chip8::loadState(const std::vector<uint8_t>& snapshot)
+{
+    StateReader in(snapshot.data(), snapshot.size());
+
+    char magic[sizeof(STATE_MAGIC)];
+    in.bytes(magic, sizeof(magic));
+    if (memcmp(magic, STATE_MAGIC, sizeof(magic)) != 0
+        || in.integer(1) != STATE_VERSION
+        || in.integer(8) != romImage->hash
+        || in.integer(1) != (uint8_t)quirksProfile)
+        return false;
+
+    // Decode everything before touching the machine, so that a truncated or
+    // corrupt snapshot leaves it as it was.
+    uint8_t newV[16];
+    uint16_t newStack[16];
+    bool newKeyboard[16];
+    Chip8Display newDisplay[2] = {};
+    uint8_t newFlags[16];
+    uint8_t newAudioPattern[16];
+    std::vector<MemoryRun> runs;
+
+    in.bytes(newV, sizeof(newV));
+    const uint16_t newI = in.integer(2);
+    const uint16_t newPC = in.integer(2);
+    const uint8_t newSP = in.integer(1);
+    for (uint16_t& address : newStack)
+        address = in.integer(2);
+    const uint8_t newDelayTimer = in.integer(1);
+    const uint8_t newSoundTimer = in.integer(1);
+    const uint16_t keys = in.integer(2);
+    for (int i = 0; i < 16; ++i)
+        newKeyboard[i] = (keys >> i) & 1;
+    const uint64_t newRandomState = in.integer(8);
+    const uint8_t newHires = in.integer(1);
+    const uint8_t newPlaneMask = in.integer(1);
+    in.bytes(newFlags, sizeof(newFlags));
+    in.bytes(newAudioPattern, sizeof(newAudioPattern));
+    const uint8_t newPitch = in.integer(1);
+
+    in.words(newDisplay[1]);
+    newDisplay[0] = newDisplay[1];
+    in.words(newDisplay[0]);
+
+    uint64_t address = 0;
+    for (;;) {
+        const uint64_t gap = in.varint();
+        const uint64_t length = in.varint();
+        if (!in.ok() || length == 0)
+            break;
+        address += gap;
+        if (address + length > Chip8Memory::SIZE) {
+            in.fail();
+            break;
+        }
+        runs.push_back({ (int)address, (int)length, in.skip(length) });
+        address += length;
+    }
+
+    if (!in.ok() || !in.atEnd() || newSP > 15 || newHires > 1
+        || newPlaneMask > 3)
+        return false;
+
+    memcpy(V, newV, sizeof(V));
+    I = newI;
+    PC = newPC;
+    SP = newSP;
+    memcpy(stack, newStack, sizeof(stack));
+    delayTimer = newDelayTimer;
+    soundTimer = newSoundTimer;
+    trap = Chip8Trap::None;
+    memcpy(keyboard, newKeyboard, sizeof(keyboard));
+    random.state = newRandomState;
+    hires = newHires;
+    planeMask = newPlaneMask;
+    memcpy(flags, newFlags, sizeof(flags));
+    memcpy(audioPattern, newAudioPattern, sizeof(audioPattern));
+    pitch = newPitch;
+    memcpy(display, newDisplay, sizeof(display));
+    markRowsChanged(~0ull);
+
+    // Pages no run touches are the image's, so they go back to sharing it.
+    // The rest are the image with the runs over it, stored where they differ.
+    // Either way the engines' caches of any code that changed are dropped.
+    const Chip8Memory& image = romImage->memory;
+    size_t run = 0;
+    for (int page = 0; page < Chip8Memory::PAGES; ++page) {
+        const int start = page * Chip8Memory::PAGE_SIZE;
+        const int end = start + Chip8Memory::PAGE_SIZE;
+        while (run < runs.size() && runs[run].end() <= start)
+            ++run;
+        if (run == runs.size() || runs[run].address >= end) {
+            restorePage(image, page);
+            continue;
+        }
+
+        for (int address = start; address < end; ++address) {
+            while (run < runs.size() && runs[run].end() <= address)
+                ++run;
+            const uint8_t value
+                = run < runs.size() && runs[run].address <= address
+                ? runs[run].bytes[address - runs[run].address]
+                : image[address];
+            if (memory[address] != value)
+                storeMemory(address, value);
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,170 @@
+#include "chip8_stats.h"
+#include "chip8.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <utility>
+
+static constexpr const char* SPAN_NAMES[Chip8Stats::SPANS]
+    = { "draw", "present" };
+
+static double toMicroseconds(std::chrono::nanoseconds duration)
+{
+    return duration.count() / 1e3;
+}
+
+void Chip8Histogram::add(std::chrono::nanoseconds duration)
+{
+    const uint64_t us = duration.count() < 0 ? 0 : duration.count() / 1000;
+    const int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    ++buckets[std::min(bucket, BUCKETS - 1)];
+    ++count;
+    total += duration;
+    max = std::max(max, duration);
+}
+
+static void writeHistogram(FILE* out, const Chip8Histogram& histogram)
+{
+    fprintf(out,
+        "{\"count\": %llu, \"total_us\": %.3f, \"mean_us\": %.3f, "
+        "\"max_us\": %.3f, \"buckets\": [",
+        (unsigned long long)histogram.count, toMicroseconds(histogram.total),
+        histogram.count == 0
+            ? 0.0
+            : toMicroseconds(histogram.total) / histogram.count,
+        toMicroseconds(histogram.max));
+
+    bool first = true;
+    for (int i = 0; i < Chip8Histogram::BUCKETS; ++i) {
+        if (histogram.buckets[i] == 0)
+            continue;
+        fprintf(out, "%s{\"below_us\": %llu, \"count\": %llu}",
+            first ? "" : ", ", 1ull << i,
+            (unsigned long long)histogram.buckets[i]);
+        first = false;
+    }
+    fprintf(out, "]}");
+}
+
+Chip8Stats::Chip8Stats()
+    : created(Clock::now())
+    , pcCounts(new uint64_t[0x10000]())
+    , opcodeCounts(new uint64_t[0x10000]())
+{
+}
+
+void Chip8Stats::recordTick()
+{
+    const Clock::time_point now = Clock::now();
+    if (ticks == 0)
+        firstTick = now;
+    else
+        tickIntervals.add(now - lastTick);
+    lastTick = now;
+    ++ticks;
+}
+
+void Chip8Stats::recordSpan(Span span, Clock::time_point start)
+{
+    const Clock::time_point now = Clock::now();
+    spans[span].add(now - start);
+    if (trace.size() < MAX_TRACE_EVENTS)
+        trace.push_back({ span, start, now - start });
+
+    if (span == Present) {
+        if (lastPresent != Clock::time_point())
+            frameTimes.add(now - lastPresent);
+        lastPresent = now;
+    }
+}
+
+bool Chip8Stats::writeJson(const std::string& path) const
+{
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == nullptr)
+        return false;
+
+    uint64_t instructions = 0;
+    std::map<std::string, uint64_t> classCounts;
+    for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+        if (opcodeCounts[opcode] != 0) {
+            classCounts[opcodeClassName(opcode)] += opcodeCounts[opcode];
+            instructions += opcodeCounts[opcode];
+        }
+    }
+
+    // Both lists hottest first.
+    std::vector<std::pair<std::string, uint64_t>> classes(
+        classCounts.begin(), classCounts.end());
+    std::stable_sort(classes.begin(), classes.end(),
+        [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    std::vector<uint32_t> pcs;
+    for (uint32_t pc = 0; pc < 0x10000; ++pc) {
+        if (pcCounts[pc] != 0)
+            pcs.push_back(pc);
+    }
+    std::stable_sort(pcs.begin(), pcs.end(), [&](uint32_t a, uint32_t b) {
+        return pcCounts[a] > pcCounts[b];
+    });
+
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"opcodes\": {",
+        (unsigned long long)instructions);
+    for (size_t i = 0; i < classes.size(); ++i) {
+        fprintf(out, "%s\n    \"%s\": %llu", i == 0 ? "" : ",",
+            classes[i].first.c_str(), (unsigned long long)classes[i].second);
+    }
+    fprintf(out, "\n  },\n  \"pcs\": [");
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        fprintf(out, "%s\n    {\"pc\": \"0x%03X\", \"count\": %llu}",
+            i == 0 ? "" : ",", pcs[i], (unsigned long long)pcCounts[pcs[i]]);
+    }
+    fprintf(out, "\n  ],\n");
+
+    // How far the ticks fell behind (positive) or ran ahead of 60Hz.
+    const double tickSeconds = ticks < 2
+        ? 0.0
+        : std::chrono::duration<double>(lastTick - firstTick).count();
+    const double driftMs
+        = ticks < 2 ? 0.0 : (tickSeconds - (ticks - 1) / 60.0) * 1e3;
+    fprintf(out,
+        "  \"timers\": {\"ticks\": %llu, \"seconds\": %.3f, \"drift_ms\": "
+        "%.3f, \"intervals\": ",
+        (unsigned long long)ticks, tickSeconds, driftMs);
+    writeHistogram(out, tickIntervals);
+    fprintf(out, "},\n");
+
+    for (int span = 0; span < SPANS; ++span) {
+        fprintf(out, "  \"%s\": ", SPAN_NAMES[span]);
+        writeHistogram(out, spans[span]);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "  \"frames\": ");
+    writeHistogram(out, frameTimes);
+    fprintf(out, "\n}\n");
+
+    return fclose(out) == 0;
+}
+
+bool Chip8Stats::writeChromeTrace(const std::string& path) const
+{
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == nullptr)
+        return false;
+
+    // Complete ("X") events, timestamped in microseconds since construction.
+    fprintf(out, "{\"traceEvents\": [");
+    for (size_t i = 0; i < trace.size(); ++i) {
+        const TraceEvent& event = trace[i];
+        fprintf(out,
+            "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+            "\"ts\": %.3f, \"dur\": %.3f}",
+            i == 0 ? "" : ",", SPAN_NAMES[event.span],
+            toMicroseconds(event.start - created),
+            toMicroseconds(event.duration));
+    }
+    fprintf(out, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+    return fclose(out) == 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+// Hot-path instrumentation, built only with CHIP8_INSTRUMENT (see
+// CMakeLists.txt); without it neither this class nor any call into it exists.
+//
+// The emulation side counts every instruction executed by opcode and by
+// address, and the 60Hz ticks against the wall clock they are meant to
+// follow. The frontend side times drawing frames into the texture and
+// presenting them, and the intervals between presents. Each side is only
+// touched from its own thread, so recording needs no synchronisation; the
+// results are read once both threads are done.
+//
+// Results are written as a JSON summary, or as a Chrome trace of the timed
+// spans that chrome://tracing and Perfetto open.
+
+#ifdef CHIP8_INSTRUMENT
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Durations in power-of-two buckets of microseconds: bucket n counts those
+// of at least 2^(n-1) and under 2^n, bucket 0 those under a microsecond.
+struct Chip8Histogram
+{
+    static constexpr int BUCKETS = 32;
+
+    void add(std::chrono::nanoseconds duration);
+
+    uint64_t buckets[BUCKETS] = {};
+    uint64_t count = 0;
+    std::chrono::nanoseconds total { 0 };
+    std::chrono::nanoseconds max { 0 };
+};
+
+class Chip8Stats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Span : uint8_t
+    {
+        // Expanding a frame into the texture.
+        Draw,
+        // Copying the texture to the window and presenting it.
+        Present,
+        SPANS,
+    };
+
+    // Trace events kept per thread; spans past this are counted but not
+    // traced.
+    static constexpr size_t MAX_TRACE_EVENTS = 1 << 20;
+
+    Chip8Stats();
+
+    // Emulation thread: one instruction, about to execute at pc.
+    void countInstruction(uint16_t pc, uint16_t opcode)
+    {
+        ++pcCounts[pc];
+        ++opcodeCounts[opcode];
+    }
+
+    // Emulation thread: a 60Hz timer tick happened now.
+    void recordTick();
+
+    // Frontend thread: a span of the given kind that started at start has
+    // just ended. Presents also close a frame.
+    void recordSpan(Span span, Clock::time_point start);
+
+    bool writeJson(const std::string& path) const;
+    bool writeChromeTrace(const std::string& path) const;
+
+private:
+    struct TraceEvent
+    {
+        Span span;
+        Clock::time_point start;
+        Clock::duration duration;
+    };
+
+    const Clock::time_point created;
+
+    // Indexed by address and by the whole 16-bit opcode; classes are only
+    // worked out when the results are written.
+    std::unique_ptr<uint64_t[]> pcCounts;
+    std::unique_ptr<uint64_t[]> opcodeCounts;
+
+    uint64_t ticks = 0;
+    Clock::time_point firstTick;
+    Clock::time_point lastTick;
+    Chip8Histogram tickIntervals;
+
+    Chip8Histogram spans[SPANS];
+    Chip8Histogram frameTimes;
+    Clock::time_point lastPresent;
+    std::vector<TraceEvent> trace;
+};
+
+#endif
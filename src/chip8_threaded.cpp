@@ -0,0 +1,229 @@
+// The threaded-code engine.
+//
+// Uses the same per-address cache as the predecoded engine, but each entry
+// holds the address of a label inside runThreaded() instead of a handler
+// pointer. Every handler ends with its own copy of the dispatch sequence and
+// jumps straight to the next instruction's label, so the indirect branch that
+// dispatches an instruction is a different one for every opcode and the host's
+// predictor can learn which instruction tends to follow which.
+//
+// runThreadedWith() is instantiated once per quirk profile, and a machine's
+// cache only ever holds labels from its own profile's instantiation.
+//
+// Labels-as-values is a GNU extension, so this file is only built when
+// CHIP8_THREADED_DISPATCH is on.
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+static constexpr int THREADED_ENTRIES = 4096 / 2;
+
+struct ThreadedHandler
+{
+    Chip8Handler handler;
+    const void* label;
+};
+
+uint64_t Chip8::runThreaded(uint64_t n)
+{
+    uint64_t executed = 0;
+    visitQuirks(quirksProfile, [&]<Chip8Quirks Quirks>() {
+        executed = runThreadedWith<Quirks>(n);
+    });
+    return executed;
+}
+
+template <Chip8Quirks Quirks>
+uint64_t Chip8::runThreadedWith(uint64_t n)
+{
+    static const ThreadedHandler handlers[] = {
+        { opSYS, &&SYS },
+        { opCLS, &&CLS },
+        { opSCD, &&SCD },
+        { opSCU, &&SCU },
+        { opSCR, &&SCR },
+        { opSCL, &&SCL },
+        { opEXIT, &&EXIT },
+        { opLOW, &&LOW },
+        { opHIGH, &&HIGH },
+        { opRET, &&RET },
+        { opJP, &&JP },
+        { opCALL, &&CALL },
+        { opSE_Vx_byte, &&SE_Vx_byte },
+        { opSNE_Vx_byte, &&SNE_Vx_byte },
+        { opSE_Vx_Vy, &&SE_Vx_Vy },
+        { opLD_I_Vx_Vy, &&LD_I_Vx_Vy },
+        { opLD_Vx_Vy_I, &&LD_Vx_Vy_I },
+        { opLD_Vx_byte, &&LD_Vx_byte },
+        { opADD_Vx_byte, &&ADD_Vx_byte },
+        { opLD_Vx_Vy, &&LD_Vx_Vy },
+        { opOR<Quirks>, &&OR },
+        { opAND<Quirks>, &&AND },
+        { opXOR<Quirks>, &&XOR },
+        { opADD_Vx_Vy, &&ADD_Vx_Vy },
+        { opSUB, &&SUB },
+        { opSHR<Quirks>, &&SHR },
+        { opSUBN, &&SUBN },
+        { opSHL<Quirks>, &&SHL },
+        { opSNE_Vx_Vy, &&SNE_Vx_Vy },
+        { opLD_I_addr, &&LD_I_addr },
+        { opJP_V0_addr<Quirks>, &&JP_V0_addr },
+        { opRND, &&RND },
+        { opDRW<Quirks>, &&DRW },
+        { opSKP, &&SKP },
+        { opSKNP, &&SKNP },
+        { opLD_I_long, &&LD_I_long },
+        { opPLANE, &&PLANE },
+        { opAUDIO, &&AUDIO },
+        { opLD_Vx_DT, &&LD_Vx_DT },
+        { opLD_Vx_K, &&LD_Vx_K },
+        { opLD_DT_Vx, &&LD_DT_Vx },
+        { opLD_ST_Vx, &&LD_ST_Vx },
+        { opADD_I_Vx, &&ADD_I_Vx },
+        { opLD_F_Vx, &&LD_F_Vx },
+        { opLD_HF_Vx, &&LD_HF_Vx },
+        { opPITCH, &&PITCH },
+        { opLD_B_Vx, &&LD_B_Vx },
+        { opLD_I_Vx<Quirks>, &&LD_I_Vx },
+        { opLD_Vx_I<Quirks>, &&LD_Vx_I },
+        { opLD_R_Vx, &&LD_R_Vx },
+        { opLD_Vx_R, &&LD_Vx_R },
+        { opInvalid, &&Invalid },
+    };
+
+    if (n == 0)
+        return 0;
+
+    if (!threaded) {
+        threadedDecodeLabel = &&Decode;
+        threaded.reset(new Chip8ThreadedInstruction[THREADED_ENTRIES]);
+        for (int i = 0; i < THREADED_ENTRIES; ++i)
+            threaded[i].label = threadedDecodeLabel;
+    }
+
+    Chip8ThreadedInstruction* const cache = threaded.get();
+    Chip8ThreadedInstruction* entry;
+    uint64_t remaining = n;
+
+#define DISPATCH()                                                             \
+    do {                                                                       \
+        if (--remaining == 0)                                                  \
+            return n;                                                          \
+        if ((PC & 1) || PC >= 4096)                                            \
+            goto Uncached;                                                     \
+        entry = &cache[PC >> 1];                                               \
+        goto* entry->label;                                                    \
+    } while (0)
+
+#define HANDLER(name)                                                          \
+    name:                                                                      \
+    op##name(*this, entry->instruction);                                       \
+    DISPATCH();
+
+// Only handlers that can trap check for it, so the rest dispatch without.
+#define TRAPPING_HANDLER(name)                                                 \
+    name:                                                                      \
+    op##name(*this, entry->instruction);                                       \
+    if (trap != Chip8Trap::None)                                               \
+        return n - remaining + 1;                                              \
+    DISPATCH();
+
+#define QUIRKS_HANDLER(name)                                                   \
+    name:                                                                      \
+    op##name<Quirks>(*this, entry->instruction);                               \
+    DISPATCH();
+
+    if ((PC & 1) || PC >= 4096)
+        goto Uncached;
+    entry = &cache[PC >> 1];
+    goto* entry->label;
+
+// Instructions at odd addresses aren't cached.
+Uncached:
+    stepInstruction<Quirks>(*this);
+    if (trap != Chip8Trap::None)
+        return n - remaining + 1;
+    DISPATCH();
+
+Decode : {
+    Chip8Handler handler = nullptr;
+
+    entry->instruction = decodeOperands((memory[PC] << 8) | memory[PC + 1]);
+    visitHandler<Quirks>(
+        entry->instruction.opcode, [&](Chip8Handler h) { handler = h; });
+
+    for (const ThreadedHandler& candidate : handlers) {
+        if (candidate.handler == handler) {
+            entry->label = candidate.label;
+            break;
+        }
+    }
+
+    goto* entry->label;
+}
+
+    HANDLER(SYS)
+    HANDLER(CLS)
+    HANDLER(SCD)
+    HANDLER(SCU)
+    HANDLER(SCR)
+    HANDLER(SCL)
+    HANDLER(EXIT)
+    HANDLER(LOW)
+    HANDLER(HIGH)
+    TRAPPING_HANDLER(RET)
+    HANDLER(JP)
+    TRAPPING_HANDLER(CALL)
+    HANDLER(SE_Vx_byte)
+    HANDLER(SNE_Vx_byte)
+    HANDLER(SE_Vx_Vy)
+    HANDLER(LD_I_Vx_Vy)
+    HANDLER(LD_Vx_Vy_I)
+    HANDLER(LD_Vx_byte)
+    HANDLER(ADD_Vx_byte)
+    HANDLER(LD_Vx_Vy)
+    QUIRKS_HANDLER(OR)
+    QUIRKS_HANDLER(AND)
+    QUIRKS_HANDLER(XOR)
+    HANDLER(ADD_Vx_Vy)
+    HANDLER(SUB)
+    QUIRKS_HANDLER(SHR)
+    HANDLER(SUBN)
+    QUIRKS_HANDLER(SHL)
+    HANDLER(SNE_Vx_Vy)
+    HANDLER(LD_I_addr)
+    QUIRKS_HANDLER(JP_V0_addr)
+    HANDLER(RND)
+    QUIRKS_HANDLER(DRW)
+    HANDLER(SKP)
+    HANDLER(SKNP)
+    HANDLER(LD_I_long)
+    HANDLER(PLANE)
+    HANDLER(AUDIO)
+    HANDLER(LD_Vx_DT)
+    HANDLER(LD_Vx_K)
+    HANDLER(LD_DT_Vx)
+    HANDLER(LD_ST_Vx)
+    HANDLER(ADD_I_Vx)
+    HANDLER(LD_F_Vx)
+    HANDLER(LD_HF_Vx)
+    HANDLER(PITCH)
+    HANDLER(LD_B_Vx)
+    QUIRKS_HANDLER(LD_I_Vx)
+    QUIRKS_HANDLER(LD_Vx_I)
+    HANDLER(LD_R_Vx)
+    HANDLER(LD_Vx_R)
+    TRAPPING_HANDLER(Invalid)
+
+#undef QUIRKS_HANDLER
+#undef TRAPPING_HANDLER
+#undef HANDLER
+#undef DISPATCH
+}
+
+void Chip8::invalidateThreaded(uint16_t address)
+{
+    threaded[address >> 1].label = threadedDecodeLabel;
+}
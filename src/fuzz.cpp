@@ -0,0 +1,312 @@
+// chip8_fuzz: differential fuzzing of the engines against each other.
+//
+// An input is a quirk profile and a ROM: its first byte picks the profile
+// (modulo the number of profiles, in availableProfiles() order) and the rest
+// is loaded at 0x200. One machine per engine runs it for the same number of
+// frames, with the timers ticking on virtual time and no keys held, and all of
+// them must end up in the same state, trap included. An input they
+// disagree on is a bug in one of the engines.
+//
+// The lockstep engine (chip8_lockstep.h) runs each input too, in one of its
+// lanes, and must agree with the first machine unless the lane stopped on
+// something it doesn't model. It doesn't count cycles, so its count is taken
+// to be right.
+//
+// The machines live for the whole process. Between inputs each is put back
+// into the state of a blank machine with Chip8::resetTo(), which only touches
+// the memory pages the previous input wrote and only drops the engines' code
+// caches for those, so an input costs little more than executing it.
+//
+// Built with CHIP8_LIBFUZZER (see CMakeLists.txt), this is a libFuzzer target
+// and libFuzzer's own main drives it. Otherwise main() runs each file given
+// on the command line once, or else --runs random inputs, and reports how
+// many inputs it got through per second. --engine, given more than once,
+// compares just the engines named. --compare-idle-skipping also runs each
+// engine with idle skipping off, so that it must agree with itself with it
+// on; with that, one engine is enough. An input the machines disagree on is
+// written to crash-<hash> and the run stops.
+
+#include "chip8.h"
+#include "chip8_lockstep.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct FuzzOptions
+{
+    uint64_t frames = 10;
+    uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    uint64_t runs = 1000000;
+    uint64_t seed = DEFAULT_RANDOM_SEED;
+    // Random inputs are up to this many bytes long.
+    size_t maxLength = 256;
+    std::vector<Chip8Engine> engines = availableEngines();
+    bool compareIdleSkipping = false;
+};
+
+static FuzzOptions options;
+
+// A blank machine for every profile, a machine per engine per profile to run
+// inputs on, or two with --compare-idle-skipping, and one per profile to copy
+// the lockstep lane into.
+struct FuzzMachines
+{
+    FuzzMachines()
+    {
+        for (Chip8Engine engine : options.engines) {
+            names.push_back(engineName(engine));
+            if (options.compareIdleSkipping)
+                names.push_back(std::string(engineName(engine)) + " no-idle");
+        }
+
+        for (Chip8Profile profile : availableProfiles()) {
+            pristine.push_back(
+                std::make_unique<Chip8>("", options.seed, profile));
+            std::vector<std::unique_ptr<Chip8>> engines;
+            for (Chip8Engine engine : options.engines) {
+                engines.push_back(pristine.back()->fork());
+                engines.back()->setEngine(engine);
+                if (options.compareIdleSkipping) {
+                    engines.push_back(pristine.back()->fork());
+                    engines.back()->setEngine(engine);
+                    engines.back()->setIdleSkipping(false);
+                }
+            }
+            machines.push_back(std::move(engines));
+            lanes.push_back(pristine.back()->fork());
+        }
+    }
+
+    std::vector<std::unique_ptr<Chip8>> pristine;
+    std::vector<std::vector<std::unique_ptr<Chip8>>> machines;
+    std::vector<std::unique_ptr<Chip8>> lanes;
+    // What runs each of a profile's machines.
+    std::vector<std::string> names;
+};
+
+// Whether a and b are in the same state, by everything stateHash() covers,
+// and have executed as many instructions. Compared field by field, so that no
+// hash collision can hide a difference; pages both still share with the blank
+// machine compare by address.
+static bool sameState(const Chip8& a, const Chip8& b)
+{
+    for (int page = 0; page < Chip8Memory::PAGES; ++page) {
+        if (a.memory.page(page) != b.memory.page(page)
+            && memcmp(a.memory.page(page), b.memory.page(page),
+                   Chip8Memory::PAGE_SIZE)
+                != 0)
+            return false;
+    }
+    return memcmp(a.V, b.V, sizeof(a.V)) == 0 && a.I == b.I && a.PC == b.PC
+        && a.SP == b.SP && memcmp(a.stack, b.stack, sizeof(a.stack)) == 0
+        && a.delayTimer == b.delayTimer && a.soundTimer == b.soundTimer
+        && a.trap == b.trap && a.cycleCount == b.cycleCount
+        && memcmp(a.display, b.display, sizeof(a.display)) == 0
+        && a.hires == b.hires && a.planeMask == b.planeMask
+        && memcmp(a.flags, b.flags, sizeof(a.flags)) == 0
+        && memcmp(a.audioPattern, b.audioPattern, sizeof(a.audioPattern)) == 0
+        && a.pitch == b.pitch && a.random.state == b.random.state;
+}
+
+static void printUsage()
+{
+    printf("Usage: chip8_fuzz [--frames N] [--ipf N] [--runs N] [--seed N] "
+           "[--max-length N] [--engine NAME...] [--compare-idle-skipping] "
+           "[input file...]\n");
+    printf("Engines:");
+    for (Chip8Engine engine : availableEngines())
+        printf(" %s", engineName(engine));
+    printf("\n");
+}
+
+// Run one input on every machine. Returns false, after printing how they
+// differ, if the machines don't agree.
+static bool runInput(const uint8_t* data, size_t size)
+{
+    static FuzzMachines fuzz;
+
+    if (size == 0)
+        return true;
+    const size_t profile = data[0] % fuzz.pristine.size();
+    const uint8_t* rom = data + 1;
+    const size_t maxRomSize
+        = Chip8RomCache::maxRomSize(fuzz.pristine[profile]->profile());
+    const size_t romSize = size - 1 < maxRomSize ? size - 1 : maxRomSize;
+
+    std::vector<std::unique_ptr<Chip8>>& machines = fuzz.machines[profile];
+    std::unique_ptr<Chip8Lockstep<8>> lockstep;
+    for (std::unique_ptr<Chip8>& machine : machines) {
+        machine->resetTo(*fuzz.pristine[profile]);
+        for (size_t i = 0; i < romSize; ++i)
+            machine->storeMemory(Chip8RomCache::ROM_START + i, rom[i]);
+        if (lockstep == nullptr)
+            lockstep = std::make_unique<Chip8Lockstep<8>>(*machine);
+
+        for (uint64_t frame = 0; frame < options.frames; ++frame) {
+            if (machine->runFrame(options.instructionsPerFrame)
+                != Chip8Trap::None)
+                break;
+        }
+    }
+
+    // The lane's memory past 0xFFF, which the lockstep engine leaves out,
+    // is the ROM's.
+    Chip8& lane = *fuzz.lanes[profile];
+    lane.resetTo(*fuzz.pristine[profile]);
+    for (size_t i = 0; i < romSize; ++i)
+        lane.storeMemory(Chip8RomCache::ROM_START + i, rom[i]);
+    for (uint64_t frame = 0; frame < options.frames; ++frame) {
+        if (lockstep->trap[0] != Chip8Trap::None)
+            break;
+        lockstep->runFrame(options.instructionsPerFrame);
+    }
+    lockstep->copyLaneTo(0, lane);
+    lane.cycleCount = machines[0]->cycleCount;
+
+    bool agree = true;
+    for (size_t i = 1; i < machines.size(); ++i)
+        agree &= sameState(*machines[i], *machines[0]);
+    if (lane.trap != Chip8Trap::UnsupportedOpcode)
+        agree &= sameState(lane, *machines[0]);
+    if (agree)
+        return true;
+
+    printf("Engines disagree, %s quirks:\n",
+        profileName(fuzz.pristine[profile]->profile()));
+    for (size_t i = 0; i < machines.size(); ++i) {
+        printf("  %-20s PC=0x%03X state %016llx trap %s\n",
+            fuzz.names[i].c_str(), machines[i]->PC,
+            (unsigned long long)machines[i]->stateHash(),
+            trapName(machines[i]->trap));
+    }
+    printf("  %-20s PC=0x%03X state %016llx trap %s\n", "lockstep", lane.PC,
+        (unsigned long long)lane.stateHash(), trapName(lane.trap));
+    return false;
+}
+
+#ifdef CHIP8_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (!runInput(data, size))
+        abort();
+    return 0;
+}
+
+#else
+
+static uint64_t fnv1a(const std::vector<uint8_t>& bytes)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint8_t byte : bytes) {
+        hash ^= byte;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Keep an input the engines disagreed on, so it can be run again.
+static void writeCrash(const std::vector<uint8_t>& input)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "crash-%016llx",
+        (unsigned long long)fnv1a(input));
+    FILE* out = fopen(path, "wb");
+    if (out == nullptr
+        || fwrite(input.data(), 1, input.size(), out) != input.size()
+        || fclose(out) != 0) {
+        printf("Failed to write input: %s\n", path);
+        return;
+    }
+    printf("Input written to %s\n", path);
+}
+
+int main(const int argc, char* argv[])
+{
+    std::vector<const char*> inputFilepaths;
+    bool pickedEngine = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            options.frames = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+            options.instructionsPerFrame = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            options.runs = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            options.seed = std::stoull(argv[++i], nullptr, 0);
+        else if (strcmp(argv[i], "--max-length") == 0 && i + 1 < argc)
+            options.maxLength = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            Chip8Engine engine;
+            if (!parseEngineName(argv[++i], engine)) {
+                printUsage();
+                exit(1);
+            }
+            if (!pickedEngine)
+                options.engines.clear();
+            options.engines.push_back(engine);
+            pickedEngine = true;
+        } else if (strcmp(argv[i], "--compare-idle-skipping") == 0)
+            options.compareIdleSkipping = true;
+        else if (argv[i][0] != '-')
+            inputFilepaths.push_back(argv[i]);
+        else {
+            printUsage();
+            exit(1);
+        }
+    }
+
+    // Comparing takes at least two machines, the lockstep lane aside.
+    const size_t machines
+        = options.engines.size() * (options.compareIdleSkipping ? 2 : 1);
+    if (options.instructionsPerFrame == 0 || options.maxLength == 0
+        || machines < 2) {
+        printUsage();
+        exit(1);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    uint64_t inputs = 0;
+    std::vector<uint8_t> input;
+    Chip8Random random(options.seed);
+    const uint64_t total
+        = inputFilepaths.empty() ? options.runs : inputFilepaths.size();
+    for (; inputs < total; ++inputs) {
+        if (inputFilepaths.empty()) {
+            input.resize(1 + random.next() % options.maxLength);
+            for (uint8_t& byte : input)
+                byte = random.nextByte();
+        } else {
+            std::ifstream file(inputFilepaths[inputs], std::ios::binary);
+            if (!file.is_open()) {
+                printf("Failed to read input: %s\n", inputFilepaths[inputs]);
+                exit(1);
+            }
+            input.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+        }
+
+        if (!runInput(input.data(), input.size())) {
+            writeCrash(input);
+            exit(1);
+        }
+    }
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+
+    printf("%llu inputs x %zu machines in %.3fs (%.0f inputs/s)\n",
+        (unsigned long long)inputs, machines,
+        elapsed.count(), inputs / elapsed.count());
+}
+
+#endif
@@ -1,17 +1,229 @@
-
 #include "chip8.h"
+#include "chip8_frames.h"
+#include "chip8_movie.h"
+#include "chip8_stats.h"
+#include "sdl_frontend.h"
 
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+static void printUsage()
+{
+    printf("Invalid args! Correct usage is:\n\tchip8 [--turbo] [--headless "
+           "[--cycles N]] [--ipf N] [--engine NAME] "
+           "[--quirks vip|chip48|schip|xochip] [--seed N] "
+           "[--record FILE | --play FILE] [--frames FILE [--frame-format "
+           "raw|y4m]]"
+#ifdef CHIP8_INSTRUMENT
+           " [--stats FILE] [--trace FILE]"
+#endif
+           " <ROM filepath>\n");
+}
+
+static void reportTrap(const Chip8& emulator)
+{
+    if (emulator.trap != Chip8Trap::None)
+        printf("Stopped at 0x%03X: %s\n", emulator.PC,
+            trapName(emulator.trap));
+}
+
+// Run the ROM without a window for a fixed number of instructions, or until
+// it traps, ticking the timers on virtual time, and report how fast that
+// went. Every frame is written to frames, if given.
+static void runHeadless(Chip8& emulator, uint64_t cycles,
+    uint64_t instructionsPerFrame, Chip8FrameWriter* frames)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // A frame that traps executes only part of n, so the count comes from
+    // the machine.
+    const uint64_t startCycle = emulator.cycleCount;
+    uint64_t executed = 0;
+    while (executed < cycles && emulator.trap == Chip8Trap::None) {
+        uint64_t n = cycles - executed;
+        if (n > instructionsPerFrame)
+            n = instructionsPerFrame;
+        emulator.runFrame(n);
+        executed += n;
+        if (frames != nullptr)
+            frames->write(emulator);
+    }
+    executed = emulator.cycleCount - startCycle;
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+
+    printf("%llu instructions in %.3fs (%.2f MIPS), PC=0x%03X\n",
+        (unsigned long long)executed, elapsed.count(),
+        executed / elapsed.count() / 1e6, emulator.PC);
+    reportTrap(emulator);
+}
+
+// Replay a recorded movie without a window, as fast as possible, and report
+// the final state so runs can be compared against a known-good one.
+static void playMovie(
+    Chip8& emulator, const Chip8Movie& movie, Chip8FrameWriter* frames)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    movie.play(emulator, frames);
+
+    const std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+
+    printf("%llu instructions in %.3fs (%.2f MIPS), PC=0x%03X, state "
+           "%016llx\n",
+        (unsigned long long)emulator.cycleCount, elapsed.count(),
+        emulator.cycleCount / elapsed.count() / 1e6, emulator.PC,
+        (unsigned long long)emulator.stateHash());
+    reportTrap(emulator);
+}
 
 int main(const int argc, char* argv[])
 {
-    if (argc != 2) {
-        printf("Invalid number of args! Correct usage is:\n\tchip8 <ROM "
-               "filepath>\n");
+    bool turbo = false;
+    bool headless = false;
+    uint64_t cycles = 100000000;
+    uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    Chip8Engine engine = DEFAULT_ENGINE;
+    Chip8Profile profile = DEFAULT_PROFILE;
+    uint64_t seed = DEFAULT_RANDOM_SEED;
+    const char* recordFilepath = nullptr;
+    const char* playFilepath = nullptr;
+    const char* romFilepath = nullptr;
+    const char* framesFilepath = nullptr;
+    Chip8FrameFormat frameFormat = Chip8FrameFormat::Raw;
+#ifdef CHIP8_INSTRUMENT
+    const char* statsFilepath = nullptr;
+    const char* traceFilepath = nullptr;
+#endif
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--turbo") == 0)
+            turbo = true;
+        else if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            cycles = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+            instructionsPerFrame = std::stoull(argv[++i]);
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!parseEngineName(argv[++i], engine)) {
+                printUsage();
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            if (!parseProfileName(argv[++i], profile)) {
+                printUsage();
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = std::stoull(argv[++i], nullptr, 0);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordFilepath = argv[++i];
+        else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+            playFilepath = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            framesFilepath = argv[++i];
+        else if (strcmp(argv[i], "--frame-format") == 0 && i + 1 < argc) {
+            if (!parseFrameFormatName(argv[++i], frameFormat)) {
+                printUsage();
+                exit(1);
+            }
+        }
+#ifdef CHIP8_INSTRUMENT
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+            statsFilepath = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            traceFilepath = argv[++i];
+#endif
+        else if (romFilepath == nullptr && argv[i][0] != '-')
+            romFilepath = argv[i];
+        else {
+            printUsage();
+            exit(1);
+        }
+    }
+
+    // Recording needs the window for input; playback never opens one. Frames
+    // are only streamed from runs without a window.
+    const bool recordHeadless
+        = recordFilepath != nullptr && (playFilepath != nullptr || headless);
+    const bool framesWindowed = framesFilepath != nullptr
+        && playFilepath == nullptr && !headless;
+    if (romFilepath == nullptr || recordHeadless || framesWindowed
+        || instructionsPerFrame == 0) {
+        printUsage();
+        exit(1);
+    }
+
+    Chip8Movie movie(seed, profile);
+    if (playFilepath != nullptr) {
+        if (!movie.load(playFilepath)) {
+            printf("Failed to read movie: %s\n", playFilepath);
+            exit(1);
+        }
+        seed = movie.seed;
+        profile = movie.profile;
+    }
+
+    Chip8 emulator(romFilepath, seed, profile);
+    emulator.setEngine(engine);
+
+#ifdef CHIP8_INSTRUMENT
+    std::unique_ptr<Chip8Stats> stats;
+    if (statsFilepath != nullptr || traceFilepath != nullptr) {
+        stats = std::make_unique<Chip8Stats>();
+        emulator.stats = stats.get();
+    }
+#endif
+
+    // The SUPER-CHIP and XO-CHIP profiles' ROMs are likely to switch to
+    // 128x64, so their streams are that size.
+    std::unique_ptr<Chip8FrameWriter> frames;
+    if (framesFilepath != nullptr) {
+        frames = std::make_unique<Chip8FrameWriter>(frameFormat,
+            profile == Chip8Profile::Schip || profile == Chip8Profile::XoChip);
+        if (!frames->open(framesFilepath)) {
+            printf("Failed to open frame stream: %s\n", framesFilepath);
+            exit(1);
+        }
+    }
+
+    if (playFilepath != nullptr)
+        playMovie(emulator, movie, frames.get());
+    else if (headless)
+        runHeadless(emulator, cycles, instructionsPerFrame, frames.get());
+    else {
+        Chip8SDLFrontend frontend(emulator,
+            std::string(romFilepath) + ".state", turbo,
+            recordFilepath != nullptr ? &movie : nullptr,
+            instructionsPerFrame);
+        frontend.run();
+
+        if (recordFilepath != nullptr && !movie.save(recordFilepath)) {
+            printf("Failed to write movie: %s\n", recordFilepath);
+            exit(1);
+        }
+    }
+
+    if (frames != nullptr && !frames->close()) {
+        printf("Failed to write frame stream: %s\n", framesFilepath);
         exit(1);
     }
 
-    Chip8 emulator(argv[1]);
-    emulator.run();
+#ifdef CHIP8_INSTRUMENT
+    if (statsFilepath != nullptr && !stats->writeJson(statsFilepath)) {
+        printf("Failed to write stats: %s\n", statsFilepath);
+        exit(1);
+    }
+    if (traceFilepath != nullptr && !stats->writeChromeTrace(traceFilepath)) {
+        printf("Failed to write trace: %s\n", traceFilepath);
+        exit(1);
+    }
+#endif
 }
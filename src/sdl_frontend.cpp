@@ -0,0 +1,450 @@
+#include "sdl_frontend.h"
+#include "chip8_frames.h"
+#include "chip8_rewind.h"
+#include "chip8_stats.h"
+
+#include <SDL.h>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+
+Chip8SDLFrontend::Chip8SDLFrontend(Chip8& emulator, std::string statePath,
+    bool turbo, Chip8Movie* movie, uint64_t instructionsPerFrame)
+    : emulator(emulator)
+    , statePath(std::move(statePath))
+    , turbo(turbo)
+    , movie(movie)
+    , instructionsPerFrame(instructionsPerFrame)
+{
+}
+
+void Chip8SDLFrontend::saveStateFile()
+{
+    const std::vector<uint8_t> snapshot = emulator.saveState();
+
+    std::ofstream file(statePath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(snapshot.data()), snapshot.size());
+    if (!file) {
+        printf("Failed to save state: %s\n", statePath.c_str());
+        return;
+    }
+    printf("Saved state to %s (%zu bytes)\n", statePath.c_str(),
+        snapshot.size());
+}
+
+void Chip8SDLFrontend::loadStateFile()
+{
+    std::ifstream file(statePath, std::ios::binary);
+    const std::vector<uint8_t> snapshot((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+
+    if (!file.is_open() || !emulator.loadState(snapshot)) {
+        printf("Failed to load state: %s\n", statePath.c_str());
+        return;
+    }
+    printf("Loaded state from %s\n", statePath.c_str());
+}
+
+void Chip8SDLFrontend::handleKeyEvent(const SDL_Event& e)
+{
+    bool isKeyPressed = e.type == SDL_KEYDOWN && e.type != SDL_KEYUP;
+    int key;
+
+    switch (e.key.keysym.sym) {
+    case SDLK_F5:
+        if (isKeyPressed && !e.key.repeat)
+            stateRequest = StateRequest::Save;
+        return;
+    case SDLK_F9:
+        // Jumping to another state would make a movie being recorded
+        // impossible to play back, so that's not allowed.
+        if (isKeyPressed && !e.key.repeat && movie == nullptr)
+            stateRequest = StateRequest::Load;
+        return;
+    case SDLK_BACKSPACE:
+        if (movie == nullptr)
+            rewinding.store(isKeyPressed, std::memory_order_relaxed);
+        return;
+
+    case SDLK_1:
+        key = 1;
+        break;
+    case SDLK_2:
+        key = 2;
+        break;
+    case SDLK_3:
+        key = 3;
+        break;
+    case SDLK_4:
+        key = 0xC;
+        break;
+
+    case SDLK_q:
+        key = 4;
+        break;
+    case SDLK_w:
+        key = 5;
+        break;
+    case SDLK_e:
+        key = 6;
+        break;
+    case SDLK_r:
+        key = 0xD;
+        break;
+
+    case SDLK_a:
+        key = 7;
+        break;
+    case SDLK_s:
+        key = 8;
+        break;
+    case SDLK_d:
+        key = 9;
+        break;
+    case SDLK_f:
+        key = 0xE;
+        break;
+
+    case SDLK_z:
+        key = 0xA;
+        break;
+    case SDLK_x:
+        key = 0;
+        break;
+    case SDLK_c:
+        key = 0xB;
+        break;
+    case SDLK_v:
+        key = 0xF;
+        break;
+    default:
+        return;
+    }
+
+    // The emulation thread picks this up before its next instruction.
+    if (isKeyPressed)
+        keys.fetch_or(1u << key, std::memory_order_relaxed);
+    else
+        keys.fetch_and(~(1u << key), std::memory_order_relaxed);
+}
+
+// Colours of a pixel by which planes it is set in.
+static constexpr Uint32 PALETTE[4]
+    = { 0xFF000000, 0xFFFFFFFF, 0xFFAA5500, 0xFFFFAA00 };
+
+void Chip8SDLFrontend::makeFrame(Frame& frame) const
+{
+    for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+        for (int row = 0; row < 64; ++row) {
+            if (emulator.hires) {
+                for (int word = 0; word < 2; ++word) {
+                    frame.screen[plane][row][word]
+                        = emulator.display[0].bits[plane][row][word]
+                        | emulator.display[1].bits[plane][row][word];
+                }
+            } else {
+                const uint64_t bits
+                    = emulator.display[0].bits[plane][row / 2][0]
+                    | emulator.display[1].bits[plane][row / 2][0];
+                frame.screen[plane][row][0] = widenPixels(bits >> 32);
+                frame.screen[plane][row][1] = widenPixels(bits);
+            }
+        }
+    }
+}
+
+// Expand the rows set in dirtyRows from one bit per pixel and plane into the
+// 128x64 texture. Each run of adjacent dirty rows is uploaded with a single
+// lock.
+static void uploadDirtyRows(SDL_Texture* texture,
+    const uint64_t (*screen)[64][2], uint64_t dirtyRows)
+{
+    uint64_t rows = dirtyRows;
+    while (rows != 0) {
+        const int first = __builtin_ctzll(rows);
+        // A run can be all 64 rows, which leaves no clear bit to count to.
+        const uint64_t clear = ~(rows >> first);
+        const int count = clear == 0 ? 64 : __builtin_ctzll(clear);
+
+        const SDL_Rect rect = { 0, first, 128, count };
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0) {
+            printf("Failed to lock texture! SDL Error: %s\n", SDL_GetError());
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            Uint32* out = reinterpret_cast<Uint32*>(
+                static_cast<Uint8*>(pixels) + i * pitch);
+            for (int col = 0; col < 128; ++col) {
+                const int word = col / 64;
+                const int shift = 63 - col % 64;
+                const int colour
+                    = ((screen[0][first + i][word] >> shift) & 1)
+                    | ((screen[1][first + i][word] >> shift) & 1) << 1;
+                out[col] = PALETTE[colour];
+            }
+        }
+
+        SDL_UnlockTexture(texture);
+        if (count == 64)
+            break;
+        rows &= ~(((1ull << count) - 1) << first);
+    }
+}
+
+static constexpr uint64_t NANOSECONDS_PER_SECOND = 1000000000;
+
+// Frames a late emulation thread may fall behind before it gives up on
+// catching up and restarts its schedule, e.g. after the host was suspended.
+static constexpr uint64_t MAX_FRAMES_BEHIND = 4;
+
+static uint64_t monotonicNow()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+// Sleep until an absolute time on the monotonic clock, so that time spent
+// running the frame doesn't push every later deadline back.
+static void sleepUntil(uint64_t deadline)
+{
+    const timespec until = { (time_t)(deadline / NANOSECONDS_PER_SECOND),
+        (long)(deadline % NANOSECONDS_PER_SECOND) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr)
+        == EINTR) {
+    }
+}
+
+void Chip8SDLFrontend::emulate()
+{
+    uint16_t lastKeys = 0;
+
+    // Deadlines are computed from the start of the schedule rather than
+    // added up, so the 60Hz period's rounding never accumulates.
+    uint64_t scheduleStart = monotonicNow();
+    uint64_t framesScheduled = 0;
+
+    uint64_t framesThisSecond = 0;
+    uint64_t instructionsThisSecond = 0;
+
+    // Allocated once here; capturing a frame never allocates.
+    auto history = std::make_unique<Chip8Rewind>(emulator);
+
+    while (!quit.load(std::memory_order_relaxed)) {
+        if (stateRequest.load(std::memory_order_relaxed)
+            != StateRequest::None) {
+            const StateRequest request
+                = stateRequest.exchange(StateRequest::None);
+            if (request == StateRequest::Save)
+                saveStateFile();
+            else if (request == StateRequest::Load) {
+                loadStateFile();
+                // The loaded keyboard state is stale; take the real one.
+                lastKeys = ~keys.load(std::memory_order_relaxed);
+            }
+        }
+
+        const uint16_t pressed = keys.load(std::memory_order_relaxed);
+        if (pressed != lastKeys) {
+            for (int i = 0; i < 16; ++i)
+                emulator.keyboard[i] = (pressed >> i) & 1;
+            lastKeys = pressed;
+            if (movie != nullptr)
+                movie->recordKeys(emulator, pressed);
+        }
+
+        const uint64_t deadline = scheduleStart
+            + (framesScheduled + 1) * NANOSECONDS_PER_SECOND / 60;
+
+        // Execution is suspended while going back in time, and after a
+        // trap until the machine is rewound or a state is loaded.
+        if (rewinding.load(std::memory_order_relaxed))
+            history->rewind(emulator);
+        else if (emulator.trap == Chip8Trap::None) {
+            // Counted by what was executed, which a trap cuts short.
+            const uint64_t cyclesBefore = emulator.cycleCount;
+            if (turbo) {
+                // Run whole batches back to back until the frame is over;
+                // the clock is only read between batches.
+                do {
+                    emulator.runCycles(TURBO_BATCH_SIZE);
+                } while (monotonicNow() < deadline
+                    && emulator.trap == Chip8Trap::None);
+            } else
+                emulator.runCycles(instructionsPerFrame);
+            instructionsThisSecond += emulator.cycleCount - cyclesBefore;
+
+            // A frame that trapped didn't finish, so time doesn't move on and
+            // there's nothing to record of it.
+            if (emulator.trap != Chip8Trap::None) {
+                printf("Stopped at 0x%03X: %s\n", emulator.PC,
+                    trapName(emulator.trap));
+            } else {
+                emulator.tickTimers();
+#ifdef CHIP8_INSTRUMENT
+                if (emulator.stats != nullptr)
+                    emulator.stats->recordTick();
+#endif
+                if (movie != nullptr)
+                    movie->recordTick(emulator);
+                history->capture(emulator);
+            }
+        }
+
+        // Hand the frame to the render thread if anything on it changed.
+        if (emulator.dirtyRows != 0) {
+            makeFrame(frames.writeBuffer());
+            frames.publish();
+            emulator.dirtyRows = 0;
+        }
+
+        if (++framesThisSecond == 60) {
+            printf("%llu Hz %llu fps\n",
+                (unsigned long long)instructionsThisSecond,
+                (unsigned long long)framesRendered.exchange(0));
+            framesThisSecond = 0;
+            instructionsThisSecond = 0;
+        }
+
+        ++framesScheduled;
+        const uint64_t now = monotonicNow();
+        if (now > deadline + MAX_FRAMES_BEHIND * NANOSECONDS_PER_SECOND / 60) {
+            scheduleStart = now;
+            framesScheduled = 0;
+        } else
+            sleepUntil(deadline);
+    }
+}
+
+void Chip8SDLFrontend::present(SDL_Renderer* renderer, SDL_Texture* texture)
+{
+    // What the texture currently holds, to tell which rows of a new frame
+    // changed. Frames the emulator publishes faster than they are presented
+    // are skipped, so their changes can't be relied on.
+    uint64_t screen[Chip8Display::PLANES][64][2] = {};
+    uploadDirtyRows(texture, screen, ~0ull);
+
+    // Set when the window needs repainting even though the display hasn't
+    // changed, e.g. after being uncovered.
+    bool redraw = true;
+
+    quit = false;
+    std::thread emulation([this] { emulate(); });
+
+    SDL_Event e;
+    while (!quit) {
+        // Sleep in the event queue until there is input, or until the next
+        // frame could be ready.
+        if (SDL_WaitEventTimeout(&e, 5)) {
+            do {
+                if (e.type == SDL_QUIT)
+                    quit = true;
+
+                if (e.type == SDL_KEYUP || e.type == SDL_KEYDOWN)
+                    handleKeyEvent(e);
+
+                if (e.type == SDL_WINDOWEVENT
+                    && e.window.event == SDL_WINDOWEVENT_EXPOSED)
+                    redraw = true;
+            } while (SDL_PollEvent(&e));
+        }
+
+        uint64_t dirtyRows = 0;
+        if (frames.update()) {
+            const Frame& frame = frames.readBuffer();
+            for (int plane = 0; plane < Chip8Display::PLANES; ++plane) {
+                for (int row = 0; row < 64; ++row) {
+                    for (int word = 0; word < 2; ++word) {
+                        uint64_t& presented = screen[plane][row][word];
+                        const uint64_t next = frame.screen[plane][row][word];
+                        if (presented != next) {
+                            presented = next;
+                            dirtyRows |= 1ull << row;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Only rows that changed since the last present are re-uploaded, and
+        // nothing is presented if none did.
+        if (dirtyRows != 0 || redraw) {
+#ifdef CHIP8_INSTRUMENT
+            Chip8Stats* stats = emulator.stats;
+            Chip8Stats::Clock::time_point start = Chip8Stats::Clock::now();
+#endif
+            uploadDirtyRows(texture, screen, dirtyRows);
+            redraw = false;
+#ifdef CHIP8_INSTRUMENT
+            if (stats != nullptr) {
+                stats->recordSpan(Chip8Stats::Draw, start);
+                start = Chip8Stats::Clock::now();
+            }
+#endif
+
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            SDL_RenderPresent(renderer);
+#ifdef CHIP8_INSTRUMENT
+            if (stats != nullptr)
+                stats->recordSpan(Chip8Stats::Present, start);
+#endif
+            framesRendered.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    emulation.join();
+}
+
+void Chip8SDLFrontend::run()
+{
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
+    else {
+        SDL_Window* window = NULL;
+        constexpr int SCREEN_HEIGHT = 320;
+        constexpr int SCREEN_WIDTH = 640;
+
+        window = SDL_CreateWindow("chip8", SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT,
+            SDL_WINDOW_SHOWN);
+
+        if (window == nullptr)
+            printf(
+                "Failed to create SDL window! SDL Error: %s\n", SDL_GetError());
+        else {
+            // Presentation may block on vsync; that only holds up this
+            // thread, never the emulation thread.
+            SDL_Renderer* renderer = SDL_CreateRenderer(window, -1,
+                SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+            if (renderer == nullptr)
+                printf("Failed to create SDL renderer! SDL Error: %s\n",
+                    SDL_GetError());
+            else {
+                // The display at native resolution; the renderer scales it
+                // up to the window when it is copied.
+                SDL_Texture* texture = SDL_CreateTexture(renderer,
+                    SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                    128, 64);
+
+                if (texture == nullptr)
+                    printf("Failed to create SDL texture! SDL Error: %s\n",
+                        SDL_GetError());
+                else {
+                    present(renderer, texture);
+                    SDL_DestroyTexture(texture);
+                }
+                SDL_DestroyRenderer(renderer);
+            }
+            SDL_DestroyWindow(window);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "chip8.h"
+#include "chip8_movie.h"
+#include "triple_buffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+union SDL_Event;
+struct SDL_Renderer;
+struct SDL_Texture;
+
+// Presents a Chip8 machine in an SDL window and feeds it keyboard input.
+//
+// Emulation runs in 60Hz frames: each executes instructionsPerFrame
+// instructions in one batch and ticks both timers once, then the emulation
+// thread sleeps until the frame's deadline, so an idle-paced ROM costs a few
+// percent of a core. In turbo mode batches of TURBO_BATCH_SIZE instructions
+// run back-to-back until the deadline instead, with no clock reads in between.
+//
+// The machine runs on its own emulation thread, while the thread that calls
+// run() handles input and presentation. The two share no locks: completed
+// frames are handed over through a triple buffer and key state comes back as
+// an atomic bitmask, so a stalled present never slows the emulation down.
+//
+// F5 saves the machine state to statePath and F9 loads it back. Holding
+// Backspace rewinds, one frame per 60Hz tick.
+//
+// If a movie is given, every key change and timer tick is recorded into it.
+// Loading states and rewinding are disabled then, as they'd break playback.
+//
+// In CHIP8_INSTRUMENT builds, timer ticks, draws and presents are recorded
+// into the machine's stats when it has them (see chip8_stats.h).
+class Chip8SDLFrontend
+{
+public:
+    static constexpr uint64_t TURBO_BATCH_SIZE = 1000;
+
+    explicit Chip8SDLFrontend(Chip8& emulator, std::string statePath,
+        bool turbo = false, Chip8Movie* movie = nullptr,
+        uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME);
+    void run();
+
+private:
+    // The screen as presented, display[0] | display[1], always at 128x64:
+    // the 64x32 mode is scaled up by two when the frame is made.
+    struct Frame
+    {
+        uint64_t screen[Chip8Display::PLANES][64][2];
+    };
+
+    // Fill in frame from the machine's display.
+    void makeFrame(Frame& frame) const;
+
+    // The emulation thread's loop: execute, tick the timers, publish and
+    // sleep, one frame at a time, until quit is set.
+    void emulate();
+
+    // The calling thread's loop, while the emulation thread runs: handle
+    // input and present frames into texture until the window is closed.
+    void present(SDL_Renderer* renderer, SDL_Texture* texture);
+
+    void handleKeyEvent(const SDL_Event& e);
+
+    // Save or load statePath; called on the emulation thread.
+    void saveStateFile();
+    void loadStateFile();
+
+    enum class StateRequest : uint8_t
+    {
+        None,
+        Save,
+        Load,
+    };
+
+    Chip8& emulator;
+    std::string statePath;
+    bool turbo;
+    Chip8Movie* movie;
+    uint64_t instructionsPerFrame;
+
+    TripleBuffer<Frame> frames;
+    // Bit n is set while key n is held down.
+    std::atomic<uint16_t> keys { 0 };
+    std::atomic<uint64_t> framesRendered { 0 };
+    std::atomic<bool> quit { false };
+    // Set while the rewind key is held down.
+    std::atomic<bool> rewinding { false };
+    // Set by the F5/F9 hotkeys for the emulation thread to act on.
+    std::atomic<StateRequest> stateRequest { StateRequest::None };
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free handoff of the latest value from one writer thread to one reader
+// thread.
+//
+// Of the three buffers, the writer owns one and fills it, the reader owns one
+// and reads it, and the third sits in the middle. Publishing swaps the
+// writer's buffer with the middle one, and the reader swaps its buffer with
+// the middle one when that holds something newer. Neither side ever waits on
+// the other: a slow reader just skips the values it never got to.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer side: the buffer to fill in, then hand over with publish().
+    T& writeBuffer() { return buffers[writeIndex]; }
+
+    void publish()
+    {
+        const uint8_t previous
+            = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel);
+        writeIndex = previous & INDEX;
+    }
+
+    // Reader side: take the most recently published value, if there is one
+    // newer than readBuffer(). Returns whether there was.
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+
+        const uint8_t previous
+            = middle.exchange(readIndex, std::memory_order_acq_rel);
+        readIndex = previous & INDEX;
+        return true;
+    }
+
+    const T& readBuffer() const { return buffers[readIndex]; }
+
+private:
+    static constexpr uint8_t INDEX = 3;
+    // Set in middle when it holds a value the reader hasn't taken yet.
+    static constexpr uint8_t FRESH = 4;
+
+    T buffers[3] {};
+
+    // Kept on separate cache lines so that the two threads don't contend
+    // on anything but middle.
+    alignas(64) std::atomic<uint8_t> middle { 1 };
+    alignas(64) uint8_t writeIndex = 0;
+    alignas(64) uint8_t readIndex = 2;
+};
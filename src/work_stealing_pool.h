@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed-size thread pool where every worker has its own task queue.
+//
+// Workers take tasks from the back of their own queue and, once that runs
+// dry, steal from the front of the others'. Each queue has its own lock, so
+// workers only contend when one of them is stealing.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned threadCount)
+        : queues(threadCount ? threadCount : 1)
+    {
+        for (size_t i = 0; i < queues.size(); ++i)
+            queues[i] = std::make_unique<Queue>();
+        for (size_t i = 0; i < queues.size(); ++i)
+            threads.emplace_back([this, i] { work(i); });
+    }
+
+    ~WorkStealingPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t size() const { return threads.size(); }
+
+    // Queue a task. Tasks are dealt out to the workers round-robin.
+    void submit(std::function<void()> task)
+    {
+        Queue& queue = *queues[nextQueue++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            ++pending;
+        }
+        wake.notify_one();
+    }
+
+    // Block until every submitted task has finished.
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool takeTask(size_t self, std::function<void()>& task)
+    {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void work(size_t self)
+    {
+        std::function<void()> task;
+
+        for (;;) {
+            if (takeTask(self, task)) {
+                task();
+                task = nullptr;
+
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (--pending == 0)
+                    idle.notify_all();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(stateMutex);
+            if (stopping)
+                return;
+            // Sleep until there is something to take or the pool stops.
+            // submit() queues before taking stateMutex to notify, so a task
+            // queued after takeTask() looked is still seen here.
+            wake.wait(lock, [this] { return stopping || unclaimed() > 0; });
+        }
+    }
+
+    size_t unclaimed()
+    {
+        size_t count = 0;
+        for (const std::unique_ptr<Queue>& queue : queues) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            count += queue->tasks.size();
+        }
+        return count;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextQueue { 0 };
+
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t pending = 0;
+    bool stopping = false;
+};
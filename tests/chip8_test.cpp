@@ -0,0 +1,583 @@
+// chip8_test: checks of the core that a differential fuzzer can't make.
+//
+// chip8_fuzz shows the engines agree with each other; these show that what
+// they agree on is right, and that the machinery around them keeps a run
+// reproducible: traps, what each quirk profile does, the SUPER-CHIP and
+// XO-CHIP instructions, idle skipping, the incremental state hash, save
+// states, input movies and the lockstep engine. Every engine runs the same
+// instruction handlers, so a wrong quirk or extension is one they would all
+// agree on; the expected values here are spelled out per profile rather than
+// taken from chip8_quirks.h. Every check runs on each
+// engine and quirk profile that applies. The programs are small hand
+// assembled ROMs, so the test needs no files.
+//
+// Prints every failed check and exits with 1 if there were any.
+
+#include "chip8.h"
+#include "chip8_lockstep.h"
+#include "chip8_movie.h"
+#include "chip8_rom.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+static int checks = 0;
+static int failures = 0;
+// The engine and profile a check ran with, for its failure message.
+static std::string context;
+
+static void check(bool passed, const char* condition, int line)
+{
+    ++checks;
+    if (!passed) {
+        ++failures;
+        printf("chip8_test.cpp:%d: %s: check failed: %s\n", line,
+            context.c_str(), condition);
+    }
+}
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+// A machine with no ROM file and the instructions in program at 0x200.
+static std::unique_ptr<Chip8> machineWith(const std::vector<uint16_t>& program,
+    Chip8Profile profile, uint64_t seed = DEFAULT_RANDOM_SEED)
+{
+    auto machine = std::make_unique<Chip8>("", seed, profile);
+    uint16_t address = Chip8RomCache::ROM_START;
+    for (uint16_t opcode : program) {
+        machine->storeMemory(address++, opcode >> 8);
+        machine->storeMemory(address++, opcode & 0xFF);
+    }
+    return machine;
+}
+
+// Everything stateHash() covers, and the trap and cycle count besides.
+static bool sameState(const Chip8& a, const Chip8& b)
+{
+    return a.stateHash() == b.stateHash() && a.trap == b.trap
+        && a.cycleCount == b.cycleCount;
+}
+
+// Draws font digits at random places, keeps count of the frames it has seen
+// a key held in V4, and returns with nothing on the stack, an underflow, on
+// the 16th. Its subroutine writes BCD digits to 0x400 and rewrites one of its
+// own instructions, 0x22E, every time it runs.
+static const std::vector<uint16_t> BUSY_PROGRAM = {
+    0x6A3C, // 200: VA = 60
+    0xFA15, // 202: DT = VA
+    0xC23F, // 204: V2 = random & 0x3F
+    0xC31F, // 206: V3 = random & 0x1F
+    0xF229, // 208: I = digit V2
+    0xD235, // 20A: draw at V2, V3
+    0x2220, // 20C: call 220
+    0xEE9E, // 20E: skip if key VE (0) is held
+    0x1204, // 210: jump 204
+    0x7401, // 212: V4 += 1
+    0x3410, // 214: skip if V4 == 16
+    0x1204, // 216: jump 204
+    0x00EE, // 218: return, with nothing to return to
+    0x0000,
+    0x0000,
+    0x0000,
+    0xA400, // 220: I = 400
+    0xF233, // 222: BCD of V2 at I
+    0x7501, // 224: V5 += 1
+    0x606B, // 226: V0 = 6B
+    0x8150, // 228: V1 = V5
+    0xA22E, // 22A: I = 22E
+    0xF155, // 22C: store V0, V1 at I, so 22E becomes 6B<V5>
+    0x6B00, // 22E: VB = 0, rewritten
+    0xF107, // 230: V1 = DT
+    0x00EE, // 232: return
+};
+
+// Every kind of idle loop skipIdleLoop() recognises: a delay timer poll, a
+// wait for a key and, at the end, a jump to itself.
+static const std::vector<uint16_t> IDLE_PROGRAM = {
+    0x6005, // 200: V0 = 5
+    0xF015, // 202: DT = V0
+    0xF107, // 204: V1 = DT
+    0x3100, // 206: skip if V1 == 0
+    0x1204, // 208: jump 204
+    0x7201, // 20A: V2 += 1
+    0xF30A, // 20C: V3 = the next key pressed
+    0x6008, // 20E: V0 = 8
+    0xF015, // 210: DT = V0
+    0xF107, // 212: V1 = DT
+    0x3100, // 214: skip if V1 == 0
+    0x1212, // 216: jump 212
+    0x1218, // 218: jump 218
+};
+
+static void testTraps(Chip8Engine engine, Chip8Profile profile)
+{
+    // A fault leaves PC on the instruction and counts it, but nothing after.
+    auto underflow = machineWith({ 0x6001, 0x00EE }, profile);
+    underflow->setEngine(engine);
+    CHECK(underflow->runCycles(100) == Chip8Trap::StackUnderflow);
+    CHECK(underflow->PC == 0x202);
+    CHECK(underflow->cycleCount == 2);
+    CHECK(underflow->V[0] == 1);
+
+    // A trapped machine stays put, timers included.
+    auto invalid = machineWith({ 0x6005, 0xF015, 0x8009 }, profile);
+    invalid->setEngine(engine);
+    CHECK(invalid->runFrame(100) == Chip8Trap::InvalidOpcode);
+    CHECK(invalid->PC == 0x204);
+    CHECK(invalid->cycleCount == 3);
+    CHECK(invalid->runFrame(100) == Chip8Trap::InvalidOpcode);
+    CHECK(invalid->cycleCount == 3);
+    CHECK(invalid->delayTimer == 5);
+
+    // Recursing forever fills the stack, and the call that finds it full
+    // faults: every call before it, and that one, are counted.
+    auto overflow = machineWith({ 0x2200 }, profile);
+    overflow->setEngine(engine);
+    CHECK(overflow->runCycles(1000) == Chip8Trap::StackOverflow);
+    CHECK(overflow->PC == 0x200);
+    CHECK(overflow->SP == 15);
+    CHECK(overflow->cycleCount == 16u);
+
+    // Loading a state clears the trap, and the machine runs again.
+    auto resumed = machineWith({ 0x6001, 0x8009 }, profile);
+    resumed->setEngine(engine);
+    resumed->runCycles(1);
+    const std::vector<uint8_t> snapshot = resumed->saveState();
+    CHECK(resumed->runCycles(10) == Chip8Trap::InvalidOpcode);
+    CHECK(resumed->loadState(snapshot));
+    CHECK(resumed->trap == Chip8Trap::None);
+    CHECK(resumed->PC == 0x202);
+}
+
+static void testQuirks(Chip8Engine engine, Chip8Profile profile)
+{
+    const bool vip = profile == Chip8Profile::Vip;
+    const bool chip48 = profile == Chip8Profile::Chip48;
+    const bool schip = profile == Chip8Profile::Schip;
+    const bool xochip = profile == Chip8Profile::XoChip;
+
+    // 8xy6 and 8xyE shift Vy on the VIP and XO-CHIP, Vx in place otherwise.
+    auto shifts = machineWith({
+                                  0x6105, // 200: V1 = 05
+                                  0x6282, // 202: V2 = 82
+                                  0x6301, // 204: V3 = 01
+                                  0x8126, // 206: V1 = V2 >> 1 or V1 >> 1
+                                  0x84F0, // 208: V4 = VF
+                                  0x832E, // 20A: V3 = V2 << 1 or V3 << 1
+                                  0x85F0, // 20C: V5 = VF
+                              },
+        profile);
+    shifts->setEngine(engine);
+    shifts->runCycles(7);
+    CHECK(shifts->V[1] == (vip || xochip ? 0x41 : 0x02));
+    CHECK(shifts->V[4] == (vip || xochip ? 0 : 1));
+    CHECK(shifts->V[3] == (vip || xochip ? 0x04 : 0x02));
+    CHECK(shifts->V[5] == (vip || xochip ? 1 : 0));
+
+    // 8xy1, 8xy2 and 8xy3 clear VF only on the VIP.
+    auto logic = machineWith({
+                                 0x6205, // 200: V2 = 05
+                                 0x6103, // 202: V1 = 03
+                                 0x6F07, // 204: VF = 07
+                                 0x8121, // 206: V1 |= V2
+                                 0x8AF0, // 208: VA = VF
+                                 0x6303, // 20A: V3 = 03
+                                 0x6F07, // 20C: VF = 07
+                                 0x8322, // 20E: V3 &= V2
+                                 0x8BF0, // 210: VB = VF
+                                 0x6403, // 212: V4 = 03
+                                 0x6F07, // 214: VF = 07
+                                 0x8423, // 216: V4 ^= V2
+                                 0x8CF0, // 218: VC = VF
+                             },
+        profile);
+    logic->setEngine(engine);
+    logic->runCycles(13);
+    CHECK(logic->V[1] == 0x07);
+    CHECK(logic->V[3] == 0x01);
+    CHECK(logic->V[4] == 0x06);
+    CHECK(logic->V[0xA] == (vip ? 0 : 7));
+    CHECK(logic->V[0xB] == (vip ? 0 : 7));
+    CHECK(logic->V[0xC] == (vip ? 0 : 7));
+
+    // Fx55 and Fx65 leave I past the last register on the VIP and XO-CHIP,
+    // at it on CHIP-48 and where it was on SUPER-CHIP.
+    const uint16_t advancedI = vip || xochip ? 0x303 : chip48 ? 0x302 : 0x300;
+    auto loadStore = machineWith({
+                                     0x6011, // 200: V0 = 11
+                                     0x6122, // 202: V1 = 22
+                                     0x6233, // 204: V2 = 33
+                                     0xA300, // 206: I = 300
+                                     0xF255, // 208: store V0-V2 at I
+                                     0x6000, // 20A: V0 = 0
+                                     0x6100, // 20C: V1 = 0
+                                     0x6200, // 20E: V2 = 0
+                                     0xA300, // 210: I = 300
+                                     0xF265, // 212: load V0-V2 from I
+                                 },
+        profile);
+    loadStore->setEngine(engine);
+    loadStore->runCycles(5);
+    CHECK(loadStore->I == advancedI);
+    CHECK(loadStore->memory[0x302] == 0x33);
+    loadStore->runCycles(5);
+    CHECK(loadStore->I == advancedI);
+    CHECK(loadStore->V[0] == 0x11);
+    CHECK(loadStore->V[1] == 0x22);
+    CHECK(loadStore->V[2] == 0x33);
+
+    // Bnnn adds V0 on the VIP and XO-CHIP; CHIP-48 and SUPER-CHIP read it as
+    // Bxnn and add Vx.
+    auto jump = machineWith({ 0x6004, 0x6208, 0xB210 }, profile);
+    jump->setEngine(engine);
+    jump->runCycles(3);
+    CHECK(jump->PC == (chip48 || schip ? 0x218 : 0x214));
+
+    // The digit 0, drawn across the bottom right corner, wraps round both
+    // edges on XO-CHIP and is clipped at them otherwise.
+    auto corner = machineWith({
+                                  0x603E, // 200: V0 = 62
+                                  0x611E, // 202: V1 = 30
+                                  0xA000, // 204: I = digit 0
+                                  0xD015, // 206: draw 5 rows at V0, V1
+                              },
+        profile);
+    corner->setEngine(engine);
+    corner->runCycles(4);
+    const uint64_t(*rows)[2] = corner->display[1].bits[0];
+    CHECK(rows[30][0] == (xochip ? 0xC000000000000003ull : 0x3));
+    CHECK(rows[31][0] == (xochip ? 0x4000000000000002ull : 0x2));
+    CHECK(rows[0][0] == (xochip ? 0x4000000000000002ull : 0));
+    CHECK(rows[2][0] == (xochip ? 0xC000000000000003ull : 0));
+    CHECK(rows[3][0] == 0);
+    CHECK(corner->V[0xF] == 0);
+}
+
+// The SUPER-CHIP and XO-CHIP instructions, which every profile decodes.
+// Programs are stepped one instruction at a time to check each one's effect.
+static void testExtensions(Chip8Engine engine, Chip8Profile profile)
+{
+    // The digit 0 is F0 90 90 90 F0, so its rows are these when drawn in the
+    // leftmost column.
+    const uint64_t edge = 0xF000000000000000ull;
+    const uint64_t sides = 0x9000000000000000ull;
+
+    auto scrolling = machineWith({
+                                     0xA000, // 200: I = digit 0
+                                     0x6000, // 202: V0 = 0
+                                     0xD005, // 204: draw 5 rows at V0, V0
+                                     0x00C2, // 206: scroll down 2
+                                     0x00FB, // 208: scroll right 4
+                                     0x00FC, // 20A: scroll left 4
+                                     0x00D1, // 20C: scroll up 1
+                                 },
+        profile);
+    scrolling->setEngine(engine);
+    const uint64_t(*rows)[2] = scrolling->display[1].bits[0];
+    scrolling->runCycles(4);
+    CHECK(rows[0][0] == 0);
+    CHECK(rows[1][0] == 0);
+    CHECK(rows[2][0] == edge);
+    CHECK(rows[3][0] == sides);
+    CHECK(rows[6][0] == edge);
+    scrolling->runCycles(1);
+    CHECK(rows[2][0] == edge >> 4);
+    CHECK(rows[3][0] == sides >> 4);
+    scrolling->runCycles(1);
+    CHECK(rows[2][0] == edge);
+    scrolling->runCycles(1);
+    CHECK(rows[1][0] == edge);
+    CHECK(rows[5][0] == edge);
+    CHECK(rows[6][0] == 0);
+    CHECK(scrolling->PC == 0x20E);
+
+    // Switching resolution clears the display. In high resolution a row is
+    // two words wide, and pixels scroll from one into the other.
+    auto resolution = machineWith({
+                                      0xA000, // 200: I = digit 0
+                                      0x6000, // 202: V0 = 0
+                                      0xD005, // 204: draw 5 rows at V0, V0
+                                      0x00FF, // 206: high resolution
+                                      0x603C, // 208: V0 = 60
+                                      0x6100, // 20A: V1 = 0
+                                      0xD015, // 20C: draw 5 rows at V0, V1
+                                      0x00FB, // 20E: scroll right 4
+                                      0xA300, // 210: I = 300
+                                      0xD110, // 212: draw 16x16 at V1, V1
+                                      0x00FE, // 214: low resolution
+                                  },
+        profile);
+    // The 16x16 sprite: a solid left half, and the row number on the right.
+    for (int row = 0; row < 16; ++row) {
+        resolution->storeMemory(0x300 + row * 2, 0xFF);
+        resolution->storeMemory(0x301 + row * 2, row);
+    }
+    resolution->setEngine(engine);
+    rows = resolution->display[1].bits[0];
+    resolution->runCycles(4);
+    CHECK(resolution->hires);
+    CHECK(rows[0][0] == 0);
+    CHECK(rows[4][0] == 0);
+    resolution->runCycles(3);
+    CHECK(rows[0][0] == edge >> 60);
+    CHECK(rows[0][1] == 0);
+    resolution->runCycles(1);
+    CHECK(rows[0][0] == 0);
+    CHECK(rows[0][1] == edge);
+    CHECK(rows[1][1] == sides);
+    resolution->runCycles(2);
+    for (int row = 0; row < 16; ++row)
+        CHECK(rows[row][0] == (0xFF00ull | row) << 48);
+    CHECK(rows[16][0] == 0);
+    CHECK(resolution->V[0xF] == 0);
+    resolution->runCycles(1);
+    CHECK(!resolution->hires);
+    CHECK(rows[0][0] == 0);
+    CHECK(rows[0][1] == 0);
+
+    // Fn01 picks the planes drawing and clearing touch. F000 nnnn loads a
+    // 16-bit I, and a skip steps over all four of its bytes. Fx29 takes the
+    // digit from Vx, not from x.
+    auto planes = machineWith({
+                                  0xF201, // 200: plane 2
+                                  0xA000, // 202: I = digit 0
+                                  0x6000, // 204: V0 = 0
+                                  0xD005, // 206: draw 5 rows at V0, V0
+                                  0xF101, // 208: plane 1
+                                  0xD005, // 20A: draw 5 rows at V0, V0
+                                  0x00E0, // 20C: clear
+                                  0xF000, // 20E: I = 1234
+                                  0x1234,
+                                  0x3000, // 212: skip if V0 == 0
+                                  0xF000, // 214: I = ABCD
+                                  0xABCD,
+                                  0x631A, // 218: V3 = 1A
+                                  0xF329, // 21A: I = digit V3
+                              },
+        profile);
+    planes->setEngine(engine);
+    const uint64_t(*first)[2] = planes->display[1].bits[0];
+    const uint64_t(*second)[2] = planes->display[1].bits[1];
+    planes->runCycles(4);
+    CHECK(planes->planeMask == 2);
+    CHECK(first[0][0] == 0);
+    CHECK(second[0][0] == edge);
+    planes->runCycles(2);
+    CHECK(planes->planeMask == 1);
+    CHECK(first[0][0] == edge);
+    planes->runCycles(1);
+    CHECK(first[0][0] == 0);
+    CHECK(second[0][0] == edge);
+    planes->runCycles(1);
+    CHECK(planes->I == 0x1234);
+    CHECK(planes->PC == 0x212);
+    planes->runCycles(1);
+    CHECK(planes->PC == 0x218);
+    planes->runCycles(2);
+    CHECK(planes->I == 0xA * 5);
+    CHECK(planes->PC == 0x21C);
+}
+
+static void testIdleSkipping(Chip8Engine engine, Chip8Profile profile)
+{
+    auto skipping = machineWith(IDLE_PROGRAM, profile);
+    auto executing = machineWith(IDLE_PROGRAM, profile);
+    skipping->setEngine(engine);
+    executing->setEngine(engine);
+    executing->setIdleSkipping(false);
+
+    for (int frame = 0; frame < 60; ++frame) {
+        const bool held = frame >= 20 && frame < 25;
+        skipping->keyboard[7] = held;
+        executing->keyboard[7] = held;
+        skipping->runFrame(100);
+        executing->runFrame(100);
+        CHECK(sameState(*skipping, *executing));
+    }
+    CHECK(skipping->PC == 0x218);
+    CHECK(skipping->V[3] == 7);
+}
+
+static void testStateHash(Chip8Engine engine, Chip8Profile profile)
+{
+    auto machine = machineWith(BUSY_PROGRAM, profile);
+    auto pristine = machine->fork();
+    machine->setEngine(engine);
+    const uint64_t pristineHash = machine->stateHash();
+
+    for (int frame = 0; frame < 30; ++frame)
+        machine->runFrame(50);
+    CHECK(machine->stateHash() != pristineHash);
+
+    // Memory's running hash is that of its bytes hashed from scratch.
+    std::vector<uint8_t> bytes(Chip8Memory::SIZE);
+    for (int address = 0; address < Chip8Memory::SIZE; ++address)
+        bytes[address] = machine->memory[address];
+    const Chip8Memory recomputed(bytes.data());
+    CHECK(recomputed == machine->memory);
+    CHECK(recomputed.hash() == machine->memory.hash());
+
+    // So is the display's, with every row's hash recomputed.
+    const uint64_t hash = machine->stateHash();
+    machine->markRowsChanged(~0ull);
+    CHECK(machine->stateHash() == hash);
+
+    machine->resetTo(*pristine);
+    CHECK(machine->stateHash() == pristineHash);
+}
+
+static void testSaveStates(Chip8Engine engine, Chip8Profile profile)
+{
+    auto machine = machineWith(BUSY_PROGRAM, profile);
+    auto diverged = machine->fork();
+    machine->setEngine(engine);
+    diverged->setEngine(engine);
+
+    for (int frame = 0; frame < 30; ++frame)
+        machine->runFrame(50);
+    const std::vector<uint8_t> snapshot = machine->saveState();
+    const uint64_t hash = machine->stateHash();
+
+    // Back to where it was, from further along the same run.
+    for (int frame = 0; frame < 30; ++frame)
+        machine->runFrame(50);
+    CHECK(machine->loadState(snapshot));
+    CHECK(machine->stateHash() == hash);
+
+    // And into a machine that took another path, with code that has been
+    // rewritten since: both must carry on alike, whatever the engines cached.
+    diverged->keyboard[0] = true;
+    for (int frame = 0; frame < 10; ++frame)
+        diverged->runFrame(50);
+    diverged->keyboard[0] = false;
+    CHECK(diverged->loadState(snapshot));
+    CHECK(diverged->stateHash() == hash);
+    for (int frame = 0; frame < 30; ++frame) {
+        machine->runFrame(50);
+        diverged->runFrame(50);
+    }
+    CHECK(diverged->stateHash() == machine->stateHash());
+
+    // A snapshot that is cut short changes nothing.
+    const uint64_t before = diverged->stateHash();
+    CHECK(!diverged->loadState(std::vector<uint8_t>(
+        snapshot.begin(), snapshot.begin() + snapshot.size() / 2)));
+    CHECK(diverged->stateHash() == before);
+
+    // Nor does one from a machine running the same ROM with other quirks.
+    for (Chip8Profile other : availableProfiles()) {
+        if (other == profile)
+            continue;
+        auto mismatched = machineWith(BUSY_PROGRAM, other);
+        const uint64_t mismatchedHash = mismatched->stateHash();
+        CHECK(!mismatched->loadState(snapshot));
+        CHECK(mismatched->stateHash() == mismatchedHash);
+    }
+}
+
+static void testMovies(Chip8Engine engine, Chip8Profile profile)
+{
+    const uint64_t seed = 1234;
+    auto recorded = machineWith(BUSY_PROGRAM, profile, seed);
+    recorded->setEngine(engine);
+    Chip8Movie movie(seed, profile);
+
+    // Key 0 is tapped for a frame now and then, too seldom to trap: a movie
+    // ends at its last event, so a replay stops short of a trap after it.
+    for (int frame = 0; frame < 60; ++frame) {
+        if (frame % 20 <= 1) {
+            const uint16_t keys = frame % 20 == 0 ? 0x0001 : 0x0000;
+            for (int i = 0; i < 16; ++i)
+                recorded->keyboard[i] = (keys >> i) & 1;
+            movie.recordKeys(*recorded, keys);
+        }
+        recorded->runCycles(37);
+        recorded->tickTimers();
+        movie.recordTick(*recorded);
+    }
+    CHECK(recorded->trap == Chip8Trap::None);
+    CHECK(recorded->V[4] != 0);
+
+    const std::string path = "chip8_test.c8mv";
+    CHECK(movie.save(path));
+    Chip8Movie loaded;
+    CHECK(loaded.load(path));
+    remove(path.c_str());
+    CHECK(loaded.seed == seed);
+    CHECK(loaded.profile == profile);
+    CHECK(loaded.events.size() == movie.events.size());
+    CHECK(loaded.length() == movie.length());
+
+    auto replayed = machineWith(BUSY_PROGRAM, profile, seed);
+    replayed->setEngine(engine);
+    loaded.play(*replayed);
+    CHECK(sameState(*replayed, *recorded));
+}
+
+// Every lane its own seed, and every other one holding key 0 so that it
+// traps, against a scalar machine per lane given the same.
+static void testLockstep(Chip8Profile profile)
+{
+    constexpr int Lanes = 8;
+    auto prototype = machineWith(BUSY_PROGRAM, profile);
+    Chip8Lockstep<Lanes> lockstep(*prototype);
+
+    std::vector<std::unique_ptr<Chip8>> machines;
+    for (int lane = 0; lane < Lanes; ++lane) {
+        machines.push_back(machineWith(BUSY_PROGRAM, profile, lane + 1));
+        machines.back()->keyboard[0] = lane % 2 == 1;
+        lockstep.random[lane] = Chip8Random(lane + 1);
+        lockstep.setKey(lane, 0, lane % 2 == 1);
+    }
+
+    for (int frame = 0; frame < 60; ++frame) {
+        lockstep.runFrame(50);
+        for (std::unique_ptr<Chip8>& machine : machines)
+            machine->runFrame(50);
+    }
+
+    for (int lane = 0; lane < Lanes; ++lane) {
+        auto copy = machineWith(BUSY_PROGRAM, profile);
+        lockstep.copyLaneTo(lane, *copy);
+        CHECK(copy->stateHash() == machines[lane]->stateHash());
+        CHECK(copy->trap == machines[lane]->trap);
+        CHECK(copy->trap
+            == (lane % 2 == 1 ? Chip8Trap::StackUnderflow : Chip8Trap::None));
+    }
+
+    // What the lockstep engine doesn't model stops the lanes that reach it.
+    auto scrolling = machineWith({ 0x6001, 0x00C1 }, profile);
+    Chip8Lockstep<Lanes> unsupported(*scrolling);
+    unsupported.runCycles(10);
+    for (int lane = 0; lane < Lanes; ++lane) {
+        CHECK(unsupported.trap[lane] == Chip8Trap::UnsupportedOpcode);
+        CHECK(unsupported.PC[lane] == 0x202);
+        CHECK(unsupported.V[0][lane] == 1);
+    }
+}
+
+int main()
+{
+    for (Chip8Profile profile : availableProfiles()) {
+        for (Chip8Engine engine : availableEngines()) {
+            context = std::string(engineName(engine)) + " engine, "
+                + profileName(profile) + " quirks";
+            testTraps(engine, profile);
+            testQuirks(engine, profile);
+            testExtensions(engine, profile);
+            testIdleSkipping(engine, profile);
+            testStateHash(engine, profile);
+            testSaveStates(engine, profile);
+            testMovies(engine, profile);
+        }
+        context = std::string("lockstep engine, ") + profileName(profile)
+            + " quirks";
+        testLockstep(profile);
+    }
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}